@@ -0,0 +1,48 @@
+# Write the files in INPUTS into a C++ header as byte arrays.
+#
+#   cmake -DROOT=<dir> -DINPUTS=<file>|<file>... -DOUTPUT=<header> -P embed_assets.cmake
+#
+# Assets are named by their path relative to ROOT. Each array ends with a zero byte that is not
+# counted in the size, so text assets can also be used as C strings.
+
+string(REPLACE "|" ";" INPUTS "${INPUTS}")
+
+# CMake regular expressions have no repetition counts
+set(line_pattern "")
+foreach(i RANGE 1 16)
+  string(APPEND line_pattern "0x[0-9a-f][0-9a-f],")
+endforeach()
+
+set(arrays "")
+set(table "")
+set(index 0)
+foreach(input IN LISTS INPUTS)
+  file(RELATIVE_PATH name "${ROOT}" "${input}")
+  file(READ "${input}" bytes HEX)
+  string(LENGTH "${bytes}" hex_length)
+  math(EXPR size "${hex_length} / 2")
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${bytes}")
+  # Break the initializer into lines of 16 bytes
+  string(REGEX REPLACE "(${line_pattern})" "\\1\n    " bytes "${bytes}")
+  string(APPEND arrays "// ${name}\n")
+  string(APPEND arrays "static constexpr unsigned char EMBEDDED_ASSET_${index}[] = {\n")
+  string(APPEND arrays "    ${bytes}0x00};\n\n")
+  string(APPEND table "    {\"${name}\", EMBEDDED_ASSET_${index}, ${size}},\n")
+  math(EXPR index "${index} + 1")
+endforeach()
+
+set(content "// Generated by cmake/embed_assets.cmake. Do not edit.\n\n")
+string(APPEND content "#pragma once\n\n#include <cstddef>\n\n")
+string(APPEND content "struct EmbeddedAsset {\n")
+string(APPEND content "    const char* name;\n    const unsigned char* data;\n    size_t size;\n")
+string(APPEND content "};\n\n${arrays}")
+string(APPEND content "static constexpr EmbeddedAsset EMBEDDED_ASSETS[] = {\n${table}};\n")
+
+# Keep the timestamp when nothing changed, so that main.cpp is not rebuilt
+if(EXISTS "${OUTPUT}")
+  file(READ "${OUTPUT}" previous)
+  if(previous STREQUAL content)
+    return()
+  endif()
+endif()
+file(WRITE "${OUTPUT}" "${content}")
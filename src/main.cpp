@@ -1,10 +1,45 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cfloat>
+#include <chrono>
 #include <cmath>
+#include <csignal>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <condition_variable>
+#include <cstring>
 #include <ctime>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#    define USE_SSE
+#    include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#    include <fcntl.h>
+#    include <sys/epoll.h>
+#    include <sys/eventfd.h>
+#    include <sys/resource.h>
+#    include <sys/socket.h>
+#    include <sys/stat.h>
+#    include <sys/timerfd.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
 #define GLAD_GL_IMPLEMENTATION
 #include <glad/gl.h>
 
@@ -22,6 +57,10 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
+#ifdef EMBED_ASSETS
+#    include "embedded_assets.h"
+#endif
+
 //////////////////////////////////
 // constants
 //////////////////////////////////
@@ -30,14 +69,34 @@ static constexpr double FPS        = 60.0;
 static constexpr float RADIUS      = 0.76f;
 static constexpr float INITIAL_POS = 3.0f;
 
+static constexpr double IDLE_WAIT_TIMEOUT = 0.5;
+
 static const glm::vec3 LIGHT_POS = glm::vec3(5.0f, 20.0f, 5.0f);
 static constexpr float SHININESS = 100.0f;
 
+static constexpr GLuint PER_DRAW_BINDING         = 0;
+static constexpr GLsizeiptr STREAM_SEGMENT_SIZE = 1 << 20;  // grows when a frame needs more
+static constexpr int IMPOSTOR_BATCH_SIZE        = 128;  // must match impostor.vert/frag
+static constexpr int PATTERN_CUBE_SIZE          = 32;
+
+// Server protocol over SOCK_SEQPACKET, one message per packet. Multi-byte fields are little endian.
+//   client -> server: [MSG_KEY][key]
+//   server -> client: [MSG_STATE][state][tile][ball target][score u32][tick u32]
+static constexpr unsigned char MSG_KEY   = 1;
+static constexpr unsigned char MSG_STATE = 2;
+static constexpr int MSG_KEY_SIZE        = 2;
+static constexpr int MSG_STATE_SIZE      = 12;
+
+// Keys selecting each cell of CELL_POS
+static const char CELL_KEYS[9] = {'Q', 'W', 'E', 'A', 'S', 'D', 'Z', 'X', 'C'};
+
 static const glm::vec3 CELL_POS[9] = {
     glm::vec3(-2.0f, 0.0f, -2.0f), glm::vec3(0.0f, 0.0f, -2.0f), glm::vec3(2.0f, 0.0f, -2.0f),
     glm::vec3(-2.0f, 0.0f, 0.0f),  glm::vec3(0.0f, 0.0f, 0.0f),  glm::vec3(2.0f, 0.0f, 0.0f),
     glm::vec3(-2.0f, 0.0f, 2.0f),  glm::vec3(0.0f, 0.0f, 2.0f),  glm::vec3(2.0f, 0.0f, 2.0f),
 };
+static constexpr int MULTI_BALL_CELLS = 16;  // cells per side of the multi-ball field
+
 static const glm::vec3 UNIT_RECTANGLE_POS[4]
     = {glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec3(-1.0f, 0.0f, 1.0f), glm::vec3(1.0f, 0.0f, 1.0f),
        glm::vec3(1.0f, 0.0f, -1.0f)};
@@ -49,17 +108,110 @@ static const glm::vec3 WHITE      = glm::vec3(1.0f, 1.0f, 1.0f);
 static const glm::vec3 RED        = glm::vec3(1.0f, 0.0f, 0.0f);
 static const glm::vec3 SPEC_COLOR = glm::vec3(0.8f, 0.8f, 0.8f);
 static const glm::vec3 AMBI_COLOR = glm::vec3(0.3f, 0.3f, 0.3f);
+static const glm::vec4 HUD_WHITE  = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+static const glm::vec4 HUD_RED    = glm::vec4(1.0f, 0.2f, 0.2f, 1.0f);
+static const glm::vec4 HUD_SHADOW = glm::vec4(0.0f, 0.0f, 0.0f, 0.5f);
+
+// Heat map of the overdraw view for 1, 2, 3, 4 and 5 or more fragments per pixel
+static const glm::vec4 OVERDRAW_COLORS[5] = {
+    glm::vec4(0.0f, 0.0f, 0.6f, 1.0f), glm::vec4(0.0f, 0.7f, 0.0f, 1.0f),
+    glm::vec4(0.9f, 0.9f, 0.0f, 1.0f), glm::vec4(1.0f, 0.5f, 0.0f, 1.0f),
+    glm::vec4(1.0f, 0.0f, 0.0f, 1.0f)};
+
+// HUD glyph atlas: 16x8 cells of 8x8 pixels covering ASCII 0-127
+static constexpr int HUD_GLYPH_CELL    = 8;
+static constexpr int HUD_GLYPH_WIDTH   = 5;
+static constexpr int HUD_GLYPH_HEIGHT  = 7;
+static constexpr int HUD_ATLAS_COLUMNS = 16;
+static constexpr int HUD_ATLAS_ROWS    = 8;
+static constexpr int HUD_SOLID_GLYPH   = 127;
+static constexpr int HUD_MAX_QUADS     = 1024;
+
+// 5x7 bitmap font for ASCII 32 (' ') to 95 ('_'), one byte per row, MSB on the left
+static const unsigned char HUD_FONT[64][HUD_GLYPH_HEIGHT] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // ' '
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04},  // '!'
+    {0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00},  // '"'
+    {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A},  // '#'
+    {0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04},  // '$'
+    {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},  // '%'
+    {0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D},  // '&'
+    {0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00},  // '''
+    {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},  // '('
+    {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},  // ')'
+    {0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00},  // '*'
+    {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00},  // '+'
+    {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08},  // ','
+    {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00},  // '-'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},  // '.'
+    {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},  // '/'
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},  // '0'
+    {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},  // '1'
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},  // '2'
+    {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},  // '3'
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},  // '4'
+    {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},  // '5'
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},  // '6'
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},  // '7'
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},  // '8'
+    {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},  // '9'
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},  // ':'
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08},  // ';'
+    {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02},  // '<'
+    {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00},  // '='
+    {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08},  // '>'
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04},  // '?'
+    {0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E},  // '@'
+    {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11},  // 'A'
+    {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},  // 'B'
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E},  // 'C'
+    {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},  // 'D'
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F},  // 'E'
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},  // 'F'
+    {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F},  // 'G'
+    {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},  // 'H'
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},  // 'I'
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},  // 'J'
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},  // 'K'
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},  // 'L'
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11},  // 'M'
+    {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},  // 'N'
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},  // 'O'
+    {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},  // 'P'
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D},  // 'Q'
+    {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},  // 'R'
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E},  // 'S'
+    {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},  // 'T'
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},  // 'U'
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},  // 'V'
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A},  // 'W'
+    {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},  // 'X'
+    {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04},  // 'Y'
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},  // 'Z'
+    {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E},  // '['
+    {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00},  // '\'
+    {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E},  // ']'
+    {0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00},  // '^'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F},  // '_'
+};
 
-static const std::string SHADER_DIRECTORY         = "../src/shaders/";
-static const std::string DATA_DIRECTORY           = "../data/";
-static const std::string COLOR_VERT_SHADER_FILE   = SHADER_DIRECTORY + "color.vert";
-static const std::string COLOR_FRAG_SHADER_FILE   = SHADER_DIRECTORY + "color.frag";
-static const std::string TEXTURE_VERT_SHADER_FILE = SHADER_DIRECTORY + "texture.vert";
-static const std::string TEXTURE_FRAG_SHADER_FILE = SHADER_DIRECTORY + "texture.frag";
-static const std::string RENDER_VERT_SHADER_FILE  = SHADER_DIRECTORY + "render.vert";
-static const std::string RENDER_FRAG_SHADER_FILE  = SHADER_DIRECTORY + "render.frag";
-static const std::string GRASS_TEX_FILE           = DATA_DIRECTORY + "grass.jpg";
-static const std::string BALL_OBJ_FILE            = DATA_DIRECTORY + "Football.obj";
+// Assets are named by their path from the repository root, which is the parent of build/
+static const std::string DEFAULT_ASSET_DIRECTORY   = "../";
+static const std::string SHADER_DIRECTORY          = "src/shaders/";
+static const std::string DATA_DIRECTORY            = "data/";
+static const std::string COLOR_VERT_SHADER_FILE    = SHADER_DIRECTORY + "color.vert";
+static const std::string COLOR_FRAG_SHADER_FILE    = SHADER_DIRECTORY + "color.frag";
+static const std::string TEXTURE_VERT_SHADER_FILE  = SHADER_DIRECTORY + "texture.vert";
+static const std::string TEXTURE_FRAG_SHADER_FILE  = SHADER_DIRECTORY + "texture.frag";
+static const std::string RENDER_VERT_SHADER_FILE   = SHADER_DIRECTORY + "render.vert";
+static const std::string RENDER_FRAG_SHADER_FILE   = SHADER_DIRECTORY + "render.frag";
+static const std::string HUD_VERT_SHADER_FILE      = SHADER_DIRECTORY + "hud.vert";
+static const std::string HUD_FRAG_SHADER_FILE      = SHADER_DIRECTORY + "hud.frag";
+static const std::string IMPOSTOR_VERT_SHADER_FILE = SHADER_DIRECTORY + "impostor.vert";
+static const std::string IMPOSTOR_FRAG_SHADER_FILE = SHADER_DIRECTORY + "impostor.frag";
+static const std::string GRASS_TEX_FILE            = DATA_DIRECTORY + "grass.jpg";
+static const std::string BALL_OBJ_FILE             = DATA_DIRECTORY + "Football.obj";
+static const std::string BALL_MTL_FILE             = DATA_DIRECTORY + "Football.mtl";
 
 //////////////////////////////////
 // global variables
@@ -67,7 +219,35 @@ static const std::string BALL_OBJ_FILE            = DATA_DIRECTORY + "Football.o
 
 static int g_win_width         = 900;
 static int g_win_height        = 900;
+static int g_fb_width          = 900;
+static int g_fb_height         = 900;
 static std::string g_win_title = "Football Juggling Game";
+
+static bool g_use_dynamic_resolution = true;
+static float g_min_render_scale      = 0.5f;
+static float g_max_render_scale      = 1.0f;
+
+static bool g_use_ball_impostor = false;
+
+static bool g_sort_front_to_back = true;
+static bool g_show_overdraw      = false;  // heat map of the fragments per pixel
+
+static int g_multi_balls     = 0;  // physics mode with this many balls when positive
+static int g_physics_threads = 0;  // 0: one per hardware thread
+
+static std::string g_asset_dir;  // read all assets from this directory instead of the binary
+
+static bool g_verbose         = true;  // print the score and messages on the console
+static int g_benchmark_frames = 0;     // run the benchmark when positive
+static unsigned int g_seed    = 0;
+static bool g_use_fixed_seed  = false;
+
+static std::string g_server_socket;       // run the headless server on this path when set
+static std::string g_load_client_socket;  // run the load generator against this path when set
+static int g_server_workers   = 0;        // 0: one per hardware thread
+static int g_load_clients     = 1000;
+static double g_load_duration = 10.0;
+
 static glm::mat4 g_proj_mat
     = glm::perspective(45.0f, (float)g_win_width / (float)g_win_height, 0.1f, 1000.0f);
 static glm::mat4 g_view_mat = glm::lookAt(glm::vec3(0.0f, 5.0f, 6.0f), glm::vec3(0.0f, 0.0f, 0.0f),
@@ -102,660 +282,1385 @@ struct Vertex3 {
     glm::vec3 diffuse;
 };
 
-class RenderObject {
-   protected:
-    static GLuint compile_shader(const std::string& filename, GLuint type) {
-        GLuint shader_id = glCreateShader(type);
+struct Vertex4 {
+    Vertex4(const glm::vec2& position_, const glm::vec2& texcoord_, const glm::vec4& color_)
+        : position(position_), texcoord(texcoord_), color(color_) {}
 
-        std::ifstream reader;
-        size_t code_size;
-        std::string code;
+    glm::vec2 position;
+    glm::vec2 texcoord;
+    glm::vec4 color;
+};
 
-        reader.open(filename.c_str(), std::ios::in);
-        if (!reader.is_open()) {
-            fprintf(stderr, "Failed to load a shader: %s\n", filename.c_str());
-            std::exit(1);
-        }
+// Per-draw constants, laid out as the std140 PerDraw uniform blocks of the shaders
+struct DrawConstants1 {
+    glm::mat4 mvp_mat;
+};
+
+struct DrawConstants3 {
+    glm::mat4 mv_mat;
+    glm::mat4 mvp_mat;
+    glm::mat4 norm_mat;
+    glm::mat4 light_mat;
+    glm::vec4 light_pos;
+    glm::vec4 spec_color;
+    glm::vec4 ambi_color;
+    float shininess;
+    float padding[3];
+};
+
+// A sphere drawn as a ray-traced quad. The axes are the columns of the rotation from camera space
+// to the space of the pattern cube map.
+struct SphereInstance {
+    glm::vec4 center_radius;  // camera space
+    glm::vec4 axis_x;
+    glm::vec4 axis_y;
+    glm::vec4 axis_z;
+};
 
-        reader.seekg(0, std::ios::end);
-        code_size = reader.tellg();
-        code.resize(code_size);
-        reader.seekg(0);
-        reader.read(&code[0], code_size);
-        reader.close();
+struct ImpostorConstants {
+    glm::mat4 proj_mat;
+    glm::vec4 light_pos;  // camera space
+    glm::vec4 spec_color;
+    glm::vec4 ambi_color;
+    float shininess;
+    float padding[3];
+    SphereInstance spheres[IMPOSTOR_BATCH_SIZE];
+};
 
-        const char* code_chars = code.c_str();
-        glShaderSource(shader_id, 1, &code_chars, NULL);
-        glCompileShader(shader_id);
+struct VertexAttrib {
+    GLuint index;
+    GLint size;
+    GLuint offset;
+};
 
-        GLint compile_status;
-        glGetShaderiv(shader_id, GL_COMPILE_STATUS, &compile_status);
-        if (compile_status == GL_FALSE) {
-            fprintf(stderr, "Failed to compile a shader!\n");
+// Shadows the bound GL objects so that redundant binds are skipped, and counts the calls issued
+// per frame. Objects are left bound after use; code that binds GL objects must go through here.
+class GLState {
+   public:
+    struct Counters {
+        int gl_calls      = 0;
+        int state_changes = 0;
+        int redundant     = 0;
+        int draw_calls    = 0;
+    };
+
+    // GL 4.5 direct state access
+    bool has_dsa() const {
+        return GLAD_GL_VERSION_4_5 != 0;
+    }
 
-            GLint log_length;
-            glGetShaderiv(shader_id, GL_INFO_LOG_LENGTH, &log_length);
-            if (log_length > 0) {
-                GLsizei length;
-                std::string err_msg;
-                err_msg.resize(log_length);
-                glGetShaderInfoLog(shader_id, log_length, &length, &err_msg[0]);
+    void use_program(GLuint program) {
+        if (program == m_program) {
+            m_current.redundant++;
+            return;
+        }
+        glUseProgram(program);
+        m_program = program;
+        count_state_change();
+    }
 
-                fprintf(stderr, "[ ERROR ] %s\n", err_msg.c_str());
-                fprintf(stderr, "%s\n", code.c_str());
-            }
+    void bind_vertex_array(GLuint vao) {
+        if (vao == m_vao) {
+            m_current.redundant++;
+            return;
+        }
+        glBindVertexArray(vao);
+        m_vao = vao;
+        count_state_change();
+    }
+
+    void bind_texture(GLuint unit, GLenum target, GLuint texture) {
+        if (unit >= MAX_TEXTURE_UNITS) {
+            fprintf(stderr, "Texture unit %u is not tracked\n", unit);
             std::exit(1);
         }
+        TextureBinding& binding = m_textures[unit];
+        if (binding.target == target && binding.texture == texture) {
+            m_current.redundant++;
+            return;
+        }
+        if (has_dsa()) {
+            glBindTextureUnit(unit, texture);
+        } else {
+            if (unit != m_active_unit) {
+                glActiveTexture(GL_TEXTURE0 + unit);
+                m_active_unit = unit;
+                count_state_change();
+            }
+            glBindTexture(target, texture);
+        }
+        binding.target  = target;
+        binding.texture = texture;
+        count_state_change();
+    }
+
+    void bind_framebuffer(GLuint fbo) {
+        if (fbo == m_framebuffer) {
+            m_current.redundant++;
+            return;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        m_framebuffer = fbo;
+        count_state_change();
+    }
 
-        return shader_id;
+    // Deleted textures are unbound by GL, and their names may be reused
+    void forget_texture(GLuint texture) {
+        for (TextureBinding& binding : m_textures) {
+            if (binding.texture == texture) {
+                binding = TextureBinding();
+            }
+        }
     }
 
-    void build_shader_program(const std::string& vert_shader_file,
-                              const std::string& frag_shader_file) {
-        GLuint vert_shader_id = compile_shader(vert_shader_file, GL_VERTEX_SHADER);
-        GLuint frag_shader_id = compile_shader(frag_shader_file, GL_FRAGMENT_SHADER);
+    void forget_program(GLuint program) {
+        if (m_program == program) {
+            m_program = 0;
+        }
+    }
 
-        m_program_id = glCreateProgram();
-        glAttachShader(m_program_id, vert_shader_id);
-        glAttachShader(m_program_id, frag_shader_id);
-        glLinkProgram(m_program_id);
+    void forget_vertex_array(GLuint vao) {
+        if (m_vao == vao) {
+            m_vao = 0;
+        }
+    }
 
-        GLint link_state;
-        glGetProgramiv(m_program_id, GL_LINK_STATUS, &link_state);
-        if (link_state == GL_FALSE) {
-            fprintf(stderr, "Failed to link shaders!\n");
+    void forget_framebuffer(GLuint fbo) {
+        if (m_framebuffer == fbo) {
+            m_framebuffer = 0;
+        }
+    }
 
-            GLint log_length;
-            glGetProgramiv(m_program_id, GL_INFO_LOG_LENGTH, &log_length);
-            if (log_length > 0) {
-                GLsizei length;
-                std::string err_msg;
-                err_msg.resize(log_length);
-                glGetProgramInfoLog(m_program_id, log_length, &length, &err_msg[0]);
+    void forget_buffer(GLuint buffer) {
+        for (UniformRange& range : m_uniform_ranges) {
+            if (range.buffer == buffer) {
+                range = UniformRange();
+            }
+        }
+    }
 
-                fprintf(stderr, "[ ERROR ] %s\n", err_msg.c_str());
+    void set_enabled(GLenum cap, bool enabled) {
+        Capability* entry = nullptr;
+        for (int i = 0; i < m_num_caps; ++i) {
+            if (m_caps[i].cap == cap) {
+                entry = &m_caps[i];
+                break;
             }
-            std::exit(1);
         }
+        if (entry && entry->enabled == enabled) {
+            m_current.redundant++;
+            return;
+        }
+        if (!entry && m_num_caps < MAX_CAPABILITIES) {
+            entry      = &m_caps[m_num_caps++];
+            entry->cap = cap;
+        }
+        if (enabled) {
+            glEnable(cap);
+        } else {
+            glDisable(cap);
+        }
+        if (entry) {
+            entry->enabled = enabled;
+        }
+        count_state_change();
+    }
 
-        glUseProgram(0);
+    void set_blend_func(GLenum src_factor, GLenum dst_factor) {
+        if (src_factor == m_blend_src && dst_factor == m_blend_dst) {
+            m_current.redundant++;
+            return;
+        }
+        glBlendFunc(src_factor, dst_factor);
+        m_blend_src = src_factor;
+        m_blend_dst = dst_factor;
+        count_state_change();
     }
 
-    void load_texture(const std::string& filename) {
-        int tex_width, tex_height, channels;
-        unsigned char* bytes
-            = stbi_load(filename.c_str(), &tex_width, &tex_height, &channels, STBI_rgb_alpha);
-        if (!bytes) {
-            fprintf(stderr, "Failed to load image file: %s\n", filename.c_str());
+    void bind_uniform_range(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+        if (binding >= MAX_UNIFORM_BINDINGS) {
+            fprintf(stderr, "Uniform binding %u is not tracked\n", binding);
             std::exit(1);
         }
+        UniformRange& range = m_uniform_ranges[binding];
+        if (range.buffer == buffer && range.offset == offset && range.size == size) {
+            m_current.redundant++;
+            return;
+        }
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+        range.buffer = buffer;
+        range.offset = offset;
+        range.size   = size;
+        count_state_change();
+    }
 
-        glGenTextures(1, &m_texture_id);
-        glBindTexture(GL_TEXTURE_2D, m_texture_id);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width, tex_height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-                     bytes);
+    void draw_elements_instanced(GLenum mode, GLsizei count, GLsizei instances) {
+        glDrawElementsInstanced(mode, count, GL_UNSIGNED_INT, 0, instances);
+        m_current.draw_calls++;
+        m_current.gl_calls++;
+    }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    void draw_elements(GLenum mode, GLsizei count, GLint base_vertex = 0) {
+        if (base_vertex == 0) {
+            glDrawElements(mode, count, GL_UNSIGNED_INT, 0);
+        } else {
+            glDrawElementsBaseVertex(mode, count, GL_UNSIGNED_INT, 0, base_vertex);
+        }
+        m_current.draw_calls++;
+        m_current.gl_calls++;
+    }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // For GL calls issued outside of this class, e.g. uniform uploads
+    void count_calls(int num_calls) {
+        m_current.gl_calls += num_calls;
+    }
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+    void end_frame() {
+        m_last_frame = m_current;
+        m_current    = Counters();
+    }
 
-        stbi_image_free(bytes);
+    const Counters& get_last_frame() const {
+        return m_last_frame;
     }
 
-    void load_obj(const std::string& obj_file, const std::string& mtl_file_dir,
-                  std::vector<Vertex3>& vertices, std::vector<unsigned int>& indices) {
-        tinyobj::ObjReaderConfig reader_config;
-        reader_config.mtl_search_path = mtl_file_dir;
-        tinyobj::ObjReader reader;
-        if (!reader.ParseFromFile(obj_file, reader_config)) {
-            if (!reader.Error().empty()) {
-                fprintf(stderr, "TinyObjReader: %s", reader.Error().c_str());
-            }
-            std::exit(1);
-        }
-        // if (!reader.Warning().empty()) {
-        //     printf("TinyObjReader: %s", reader.Warning().c_str());
-        // }
-
-        auto& attrib    = reader.GetAttrib();
-        auto& shapes    = reader.GetShapes();
-        auto& materials = reader.GetMaterials();
-
-        for (size_t s = 0; s < shapes.size(); s++) {
-            size_t index_offset = 0;
-            for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-                size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
-                for (size_t v = 0; v < fv; v++) {
-                    glm::vec3 position, normal, diffuse;
-                    tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                    position = glm::vec3(attrib.vertices[3 * size_t(idx.vertex_index) + 0],
-                                         attrib.vertices[3 * size_t(idx.vertex_index) + 1],
-                                         attrib.vertices[3 * size_t(idx.vertex_index) + 2]);
-                    if (idx.normal_index >= 0) {
-                        normal = glm::vec3(attrib.normals[3 * size_t(idx.normal_index) + 0],
-                                           attrib.normals[3 * size_t(idx.normal_index) + 1],
-                                           attrib.normals[3 * size_t(idx.normal_index) + 2]);
-                    }
-                    diffuse = glm::vec3(materials[shapes[s].mesh.material_ids[f]].diffuse[0],
-                                        materials[shapes[s].mesh.material_ids[f]].diffuse[1],
-                                        materials[shapes[s].mesh.material_ids[f]].diffuse[2]);
+    const Counters& get_current_frame() const {
+        return m_current;
+    }
 
-                    indices.push_back((unsigned int)vertices.size());
-                    vertices.push_back(Vertex3(position, normal, diffuse));
-                }
-                index_offset += fv;
-            }
-        }
+   private:
+    static constexpr GLuint MAX_TEXTURE_UNITS    = 8;
+    static constexpr int MAX_CAPABILITIES        = 8;
+    static constexpr GLuint MAX_UNIFORM_BINDINGS = 4;
+
+    struct TextureBinding {
+        GLenum target  = 0;
+        GLuint texture = 0;
+    };
+
+    struct Capability {
+        GLenum cap   = 0;
+        bool enabled = false;
+    };
+
+    struct UniformRange {
+        GLuint buffer   = 0;
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+    };
+
+    void count_state_change() {
+        m_current.state_changes++;
+        m_current.gl_calls++;
     }
 
-    void init_vao1(const std::vector<Vertex1>& vertices, const std::vector<unsigned int>& indices) {
-        glGenVertexArrays(1, &m_vao_id);
-        glBindVertexArray(m_vao_id);
+    GLuint m_program     = 0;
+    GLuint m_vao         = 0;
+    GLuint m_framebuffer = 0;
+    GLuint m_active_unit = 0;
+    TextureBinding m_textures[MAX_TEXTURE_UNITS];
+    Capability m_caps[MAX_CAPABILITIES];
+    int m_num_caps     = 0;
+    GLenum m_blend_src = GL_ONE;  // GL defaults
+    GLenum m_blend_dst = GL_ZERO;
+    UniformRange m_uniform_ranges[MAX_UNIFORM_BINDINGS];
+
+    Counters m_current;
+    Counters m_last_frame;
+};
 
-        glGenBuffers(1, &m_vbo_id);
-        glBindBuffer(GL_ARRAY_BUFFER, m_vbo_id);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex1) * vertices.size(), vertices.data(),
-                     GL_STATIC_DRAW);
+static GLState g_gl_state;
+
+enum class GpuCategory {
+    VERTEX_BUFFER,
+    INDEX_BUFFER,
+    STREAM_BUFFER,
+    TEXTURE,
+    RENDER_TARGET,
+    VERTEX_ARRAY,
+    FRAMEBUFFER,
+    PROGRAM,
+    NUM_CATEGORIES,
+};
 
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex1),
-                              (void*)offsetof(Vertex1, position));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex1),
-                              (void*)offsetof(Vertex1, color));
-
-        glGenBuffers(1, &m_ibo_id);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo_id);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), indices.data(),
-                     GL_STATIC_DRAW);
-
-        m_buffer_size = (GLsizei)indices.size();
-
-        glBindVertexArray(0);
-    }
-
-    void init_vao2(const std::vector<Vertex2>& vertices, const std::vector<unsigned int>& indices) {
-        glGenVertexArrays(1, &m_vao_id);
-        glBindVertexArray(m_vao_id);
-
-        glGenBuffers(1, &m_vbo_id);
-        glBindBuffer(GL_ARRAY_BUFFER, m_vbo_id);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex2) * vertices.size(), vertices.data(),
-                     GL_STATIC_DRAW);
-
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex2),
-                              (void*)offsetof(Vertex2, position));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex2),
-                              (void*)offsetof(Vertex2, texcoord));
-
-        glGenBuffers(1, &m_ibo_id);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo_id);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), indices.data(),
-                     GL_STATIC_DRAW);
-
-        m_buffer_size = (GLsizei)indices.size();
-
-        glBindVertexArray(0);
-    }
-
-    void init_vao3(const std::vector<Vertex3>& vertices, const std::vector<unsigned int>& indices) {
-        glGenVertexArrays(1, &m_vao_id);
-        glBindVertexArray(m_vao_id);
-
-        glGenBuffers(1, &m_vbo_id);
-        glBindBuffer(GL_ARRAY_BUFFER, m_vbo_id);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex3) * vertices.size(), vertices.data(),
-                     GL_STATIC_DRAW);
-
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex3),
-                              (void*)offsetof(Vertex3, position));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex3),
-                              (void*)offsetof(Vertex3, normal));
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex3),
-                              (void*)offsetof(Vertex3, diffuse));
-
-        glGenBuffers(1, &m_ibo_id);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo_id);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), indices.data(),
-                     GL_STATIC_DRAW);
-
-        m_buffer_size = (GLsizei)indices.size();
-
-        glBindVertexArray(0);
-    }
-
-    void draw_elements1(const glm::mat4& mvp_mat) {
-        glUseProgram(m_program_id);
-        glBindVertexArray(m_vao_id);
-        GLuint uid = glGetUniformLocation(m_program_id, "u_mvp_mat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvp_mat));
-        glDrawElements(m_mode, m_buffer_size, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-        glUseProgram(0);
-    }
-
-    void draw_elements2(const glm::mat4& mvp_mat) {
-        glUseProgram(m_program_id);
-        glBindVertexArray(m_vao_id);
-        GLuint uid = glGetUniformLocation(m_program_id, "u_mvp_mat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvp_mat));
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, m_texture_id);
-        uid = glGetUniformLocation(m_program_id, "u_texture");
-        glUniform1i(uid, 0);
-        glDrawElements(m_mode, m_buffer_size, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glUseProgram(0);
-    }
-
-    void draw_elements3(const glm::mat4& mv_mat, const glm::mat4& mvp_mat,
-                        const glm::mat4& norm_mat, const glm::mat4& light_mat,
-                        const glm::vec3& light_pos, float shininess) {
-        glUseProgram(m_program_id);
-        glBindVertexArray(m_vao_id);
-        GLuint uid;
-        uid = glGetUniformLocation(m_program_id, "u_mv_mat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mv_mat));
-        uid = glGetUniformLocation(m_program_id, "u_mvp_mat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(mvp_mat));
-        uid = glGetUniformLocation(m_program_id, "u_norm_mat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(norm_mat));
-        uid = glGetUniformLocation(m_program_id, "u_light_mat");
-        glUniformMatrix4fv(uid, 1, GL_FALSE, glm::value_ptr(light_mat));
-        uid = glGetUniformLocation(m_program_id, "u_light_pos");
-        glUniform3fv(uid, 1, glm::value_ptr(light_pos));
-        uid = glGetUniformLocation(m_program_id, "u_specColor");
-        glUniform3fv(uid, 1, glm::value_ptr(SPEC_COLOR));
-        uid = glGetUniformLocation(m_program_id, "u_ambiColor");
-        glUniform3fv(uid, 1, glm::value_ptr(AMBI_COLOR));
-        uid = glGetUniformLocation(m_program_id, "u_shininess");
-        glUniform1f(uid, shininess);
-        glDrawElements(GL_TRIANGLES, m_buffer_size, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-        glUseProgram(0);
-    }
-
-   protected:
-    GLuint m_vao_id       = 0;
-    GLuint m_vbo_id       = 0;
-    GLuint m_ibo_id       = 0;
-    GLsizei m_buffer_size = 0;
-    GLuint m_texture_id   = 0;
-    GLuint m_program_id   = 0;
-    GLuint m_mode         = 0;
-};
-
-class Ground : public RenderObject {
+// Live GL objects and the bytes requested for their storage, by category. Drivers may pad or
+// compress the storage, so the bytes are a budget estimate rather than a measurement.
+class GpuResourceTracker {
    public:
-    Ground() {
-        m_mode = GL_TRIANGLES;
+    struct Usage {
+        int count            = 0;
+        long long bytes      = 0;
+        long long peak_bytes = 0;
+    };
+
+    void add(GpuCategory category, long long bytes) {
+        update(m_usages[(int)category], 1, bytes);
+        update(m_total, 1, bytes);
     }
 
-    void init() {
-        unsigned int idx = 0;
-        std::vector<Vertex2> vertices;
-        std::vector<unsigned int> indices;
-        for (int i = 0; i < 3; i++) {
-            Vertex2 v(UNIT_RECTANGLE_POS[UNIT_RECTANGLE_INDEX[0][i]],
-                      6.0f * UNIT_RECTANGLE_UV[UNIT_RECTANGLE_INDEX[0][i]]);
-            vertices.push_back(v);
-            indices.push_back(idx++);
-        }
-        for (int i = 0; i < 3; i++) {
-            Vertex2 v(UNIT_RECTANGLE_POS[UNIT_RECTANGLE_INDEX[1][i]],
-                      6.0f * UNIT_RECTANGLE_UV[UNIT_RECTANGLE_INDEX[1][i]]);
-            vertices.push_back(v);
-            indices.push_back(idx++);
-        }
-        init_vao2(vertices, indices);
-        load_texture(GRASS_TEX_FILE);
-        build_shader_program(TEXTURE_VERT_SHADER_FILE, TEXTURE_FRAG_SHADER_FILE);
+    void remove(GpuCategory category, long long bytes) {
+        update(m_usages[(int)category], -1, -bytes);
+        update(m_total, -1, -bytes);
     }
 
-    void draw() {
-        glm::mat4 model_mat = glm::mat4(1.0f);
-        model_mat           = glm::translate(model_mat, glm::vec3(0.0f, -RADIUS * 2, 0.0f));
-        model_mat           = glm::scale(model_mat, glm::vec3(32.0f));
-        glm::mat4 mvp_mat   = g_proj_mat * g_view_mat * model_mat;
-        draw_elements2(mvp_mat);
+    const Usage& get_usage(GpuCategory category) const {
+        return m_usages[(int)category];
     }
-};
 
-class Grid : public RenderObject {
-   public:
-    Grid() {
-        m_mode = GL_LINES;
+    const Usage& get_total() const {
+        return m_total;
     }
 
-    void init() {
-        unsigned int idx = 0;
-        std::vector<Vertex1> vertices;
-        std::vector<unsigned int> indices;
-        int index_four[5] = {
-            0, 1, 2, 3, 0,
-        };
-        for (int j = 0; j < 9; ++j) {
-            for (int i = 0; i < 4; ++i) {
-                for (int k = 0; k < 2; ++k) {
-                    glm::vec3 pos = UNIT_RECTANGLE_POS[index_four[i + k]] + get_pos(j);
-                    Vertex1 v(pos, WHITE);
-                    vertices.push_back(v);
-                    indices.push_back(idx++);
-                }
-            }
+    void print_summary(FILE* out) const {
+        fprintf(out, "%-16s %6s %12s %12s\n", "GPU resources", "count", "KB", "peak KB");
+        for (int i = 0; i < (int)GpuCategory::NUM_CATEGORIES; ++i) {
+            print_usage(out, CATEGORY_NAMES[i], m_usages[i]);
         }
-        init_vao1(vertices, indices);
-        build_shader_program(COLOR_VERT_SHADER_FILE, COLOR_FRAG_SHADER_FILE);
+        print_usage(out, "total", m_total);
     }
 
-    void draw() {
-        glm::mat4 model_mat = glm::mat4(1.0f);
-        glm::mat4 mvp_mat   = g_proj_mat * g_view_mat * model_mat;
-        draw_elements1(mvp_mat);
+   private:
+    static constexpr const char* CATEGORY_NAMES[] = {
+        "vertex buffers", "index buffers", "stream buffers", "textures",
+        "render targets", "vertex arrays", "framebuffers",   "programs",
+    };
+
+    static void update(Usage& usage, int count, long long bytes) {
+        usage.count += count;
+        usage.bytes += bytes;
+        usage.peak_bytes = std::max(usage.peak_bytes, usage.bytes);
     }
 
-   private:
-    glm::vec3 get_pos(int pos_idx) {
-        return CELL_POS[pos_idx] + glm::vec3(0.0f, -RADIUS, 0.0f);
+    static void print_usage(FILE* out, const char* name, const Usage& usage) {
+        fprintf(out, "  %-14s %6d %12.1f %12.1f\n", name, usage.count, usage.bytes / 1024.0,
+                usage.peak_bytes / 1024.0);
     }
+
+    Usage m_usages[(int)GpuCategory::NUM_CATEGORIES];
+    Usage m_total;
 };
 
-enum class GameState {
-    BEFORE_START,
-    FALLING,
-    JUGGLING,
-    FAILED,
+constexpr const char* GpuResourceTracker::CATEGORY_NAMES[];
+
+static GpuResourceTracker g_gpu_resources;
+
+enum class GLObjectType {
+    BUFFER,
+    TEXTURE,
+    RENDERBUFFER,
+    FRAMEBUFFER,
+    VERTEX_ARRAY,
+    PROGRAM,
 };
 
-class Tile : public RenderObject {
+// Owner of one GL object, which it registers with g_gpu_resources. The object is deleted when
+// the handle is destroyed or assigned, so the GL context must still be current at that point.
+class GLHandle {
    public:
-    Tile(const glm::vec3& color, int pos_idx = 4) : m_color(color), m_pos_idx(pos_idx) {
-        m_mode = GL_TRIANGLES;
+    GLHandle() = default;
+
+    // target is only used to create textures with DSA
+    static GLHandle create(GLObjectType type, GpuCategory category, long long bytes,
+                           GLenum target = 0) {
+        GLuint id = 0;
+        if (type == GLObjectType::PROGRAM) {
+            id = glCreateProgram();
+        } else if (g_gl_state.has_dsa()) {
+            switch (type) {
+                case GLObjectType::BUFFER:
+                    glCreateBuffers(1, &id);
+                    break;
+                case GLObjectType::TEXTURE:
+                    glCreateTextures(target, 1, &id);
+                    break;
+                case GLObjectType::RENDERBUFFER:
+                    glCreateRenderbuffers(1, &id);
+                    break;
+                case GLObjectType::FRAMEBUFFER:
+                    glCreateFramebuffers(1, &id);
+                    break;
+                default:
+                    glCreateVertexArrays(1, &id);
+                    break;
+            }
+        } else {
+            switch (type) {
+                case GLObjectType::BUFFER:
+                    glGenBuffers(1, &id);
+                    break;
+                case GLObjectType::TEXTURE:
+                    glGenTextures(1, &id);
+                    break;
+                case GLObjectType::RENDERBUFFER:
+                    glGenRenderbuffers(1, &id);
+                    break;
+                case GLObjectType::FRAMEBUFFER:
+                    glGenFramebuffers(1, &id);
+                    break;
+                default:
+                    glGenVertexArrays(1, &id);
+                    break;
+            }
+        }
+        return GLHandle(type, category, id, bytes);
     }
 
-    void init() {
-        unsigned int idx = 0;
-        std::vector<Vertex1> vertices;
-        std::vector<unsigned int> indices;
-        for (int i = 0; i < 3; i++) {
-            Vertex1 v(UNIT_RECTANGLE_POS[UNIT_RECTANGLE_INDEX[0][i]], m_color);
-            vertices.push_back(v);
-            indices.push_back(idx++);
-        }
-        for (int i = 0; i < 3; i++) {
-            Vertex1 v(UNIT_RECTANGLE_POS[UNIT_RECTANGLE_INDEX[1][i]], m_color);
-            vertices.push_back(v);
-            indices.push_back(idx++);
+    GLHandle(const GLHandle&) = delete;
+    GLHandle& operator=(const GLHandle&) = delete;
+
+    GLHandle(GLHandle&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    GLHandle& operator=(GLHandle&& other) noexcept {
+        if (this != &other) {
+            reset();
+            m_type        = other.m_type;
+            m_category    = other.m_category;
+            m_id          = other.m_id;
+            m_bytes       = other.m_bytes;
+            other.m_id    = 0;
+            other.m_bytes = 0;
         }
-        init_vao1(vertices, indices);
-        build_shader_program(COLOR_VERT_SHADER_FILE, COLOR_FRAG_SHADER_FILE);
+        return *this;
     }
 
-    void draw() {
-        glm::mat4 model_mat = glm::mat4(1.0f);
-        model_mat           = glm::translate(model_mat, get_pos());
-        glm::mat4 mvp_mat   = g_proj_mat * g_view_mat * model_mat;
-        draw_elements1(mvp_mat);
+    ~GLHandle() {
+        reset();
     }
 
-    void set_pos_number(int pos_idx) {
-        m_pos_idx = pos_idx;
+    GLuint get() const {
+        return m_id;
     }
 
-    void set_pos_number_by_key(char key) {
-        switch (key) {
-            case 'Q':
-                m_pos_idx = 0;
-                break;
-            case 'W':
-                m_pos_idx = 1;
-                break;
-            case 'E':
-                m_pos_idx = 2;
-                break;
-            case 'A':
-                m_pos_idx = 3;
-                break;
-            case 'S':
-                m_pos_idx = 4;
+    void reset() {
+        if (m_id == 0) {
+            return;
+        }
+        switch (m_type) {
+            case GLObjectType::BUFFER:
+                g_gl_state.forget_buffer(m_id);
+                glDeleteBuffers(1, &m_id);
                 break;
-            case 'D':
-                m_pos_idx = 5;
+            case GLObjectType::TEXTURE:
+                g_gl_state.forget_texture(m_id);
+                glDeleteTextures(1, &m_id);
                 break;
-            case 'Z':
-                m_pos_idx = 6;
+            case GLObjectType::RENDERBUFFER:
+                glDeleteRenderbuffers(1, &m_id);
                 break;
-            case 'X':
-                m_pos_idx = 7;
+            case GLObjectType::FRAMEBUFFER:
+                g_gl_state.forget_framebuffer(m_id);
+                glDeleteFramebuffers(1, &m_id);
                 break;
-            case 'C':
-                m_pos_idx = 8;
+            case GLObjectType::VERTEX_ARRAY:
+                g_gl_state.forget_vertex_array(m_id);
+                glDeleteVertexArrays(1, &m_id);
                 break;
-            default:
+            case GLObjectType::PROGRAM:
+                g_gl_state.forget_program(m_id);
+                glDeleteProgram(m_id);
                 break;
         }
-    }
-
-    int get_pos_idx() const {
-        return m_pos_idx;
+        g_gpu_resources.remove(m_category, m_bytes);
+        m_id    = 0;
+        m_bytes = 0;
     }
 
    private:
-    glm::vec3 get_pos() {
-        return CELL_POS[m_pos_idx] + glm::vec3(0.0f, -RADIUS, 0.0f);
+    GLHandle(GLObjectType type, GpuCategory category, GLuint id, long long bytes)
+        : m_type(type), m_category(category), m_id(id), m_bytes(bytes) {
+        g_gpu_resources.add(m_category, m_bytes);
     }
 
-   private:
-    glm::vec3 m_color;
-    int m_pos_idx = 4;
+    GLObjectType m_type    = GLObjectType::BUFFER;
+    GpuCategory m_category = GpuCategory::VERTEX_BUFFER;
+    GLuint m_id            = 0;
+    long long m_bytes      = 0;
 };
 
-class Ball : public RenderObject {
+// Ring buffer for data written every frame (per-draw constants, HUD vertices). It is split into
+// STREAM_SEGMENTS segments, one per frame in flight, each guarded by a fence. Without GL 4.4
+// buffer storage it falls back to one segment that is orphaned at the start of every frame.
+// A frame that does not fit replaces the buffer with one of twice the segment size.
+class StreamBuffer {
    public:
-    Ball() {
-        reset();
-        m_mode = GL_TRIANGLES;
+    void init(GLsizeiptr segment_size) {
+        m_segment_size = segment_size;
+        m_persistent   = GLAD_GL_VERSION_4_4 != 0;
+
+        GLint alignment;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        m_uniform_alignment = alignment;
+
+        if (m_persistent) {
+            const GLsizeiptr size  = m_segment_size * STREAM_SEGMENTS;
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            m_buffer = GLHandle::create(GLObjectType::BUFFER, GpuCategory::STREAM_BUFFER, size);
+            if (g_gl_state.has_dsa()) {
+                glNamedBufferStorage(m_buffer.get(), size, NULL, flags);
+                m_mapped = (unsigned char*)glMapNamedBufferRange(m_buffer.get(), 0, size, flags);
+            } else {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer.get());
+                glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+                m_mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            }
+        } else {
+            m_buffer = GLHandle::create(GLObjectType::BUFFER, GpuCategory::STREAM_BUFFER,
+                                        m_segment_size);
+            m_shadow.assign(m_segment_size, 0);
+            m_mapped = m_shadow.data();
+            orphan();
+        }
     }
 
-    float get_falling_pos() const {
-        return m_falling_pos;
+    // Delete the buffer and pending fences while the context is still current
+    void release() {
+        for (GLsync& fence : m_fences) {
+            if (fence) {
+                glDeleteSync(fence);
+                fence = 0;
+            }
+        }
+        m_buffer.reset();
+        m_mapped = nullptr;
     }
 
-    bool is_fallen() const {
-        return m_rev_angle >= 180.0f;
-    }
+    void begin_frame() {
+        m_head        = 0;
+        m_last_wait_s = 0.0;
+        if (!m_persistent) {
+            orphan();
+            return;
+        }
 
-    int get_next_pos_idx() const {
-        return m_next_pos_idx;
+        m_segment     = (m_segment + 1) % STREAM_SEGMENTS;
+        GLsync& fence = m_fences[m_segment];
+        if (fence) {
+            const double start = glfwGetTime();
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000)
+                   == GL_TIMEOUT_EXPIRED) {
+            }
+            m_last_wait_s = glfwGetTime() - start;
+            m_max_wait_s  = std::max(m_max_wait_s, m_last_wait_s);
+            glDeleteSync(fence);
+            fence = 0;
+        }
     }
 
-    void set_dest() {
-        m_last_pos_idx    = m_next_pos_idx;
-        m_rev_angle       = 0.0f;
-        m_next_pos_idx    = get_random_next_pos_idx(m_last_pos_idx);
-        m_rev_angular_vel = get_random_rev_angular_vel();
-        m_rot_angular_vel = get_random_rot_angular_vel();
-        calc_rotation();
+    void end_frame() {
+        if (m_persistent) {
+            m_fences[m_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
     }
 
-    void reset() {
-        m_falling_pos     = INITIAL_POS;
-        m_last_pos_idx    = 4;
-        m_next_pos_idx    = 4;
-        m_rot_angle       = 0.0f;
-        m_rev_angle       = 0.0f;
-        m_rot_angular_vel = 1.0f;
-        m_rev_angular_vel = 2.25f;
+    // Returns memory for at most max_size bytes; commit() the bytes actually written before the
+    // next reserve()
+    void* reserve(GLsizeiptr max_size, GLsizeiptr alignment) {
+        GLsizeiptr offset = (m_head + alignment - 1) / alignment * alignment;
+        if (offset + max_size > m_segment_size) {
+            grow(std::max(m_segment_size * 2, max_size));
+            offset = 0;
+        }
+        m_reserved = offset;
+        return m_mapped + segment_base() + offset;
     }
 
-    void init() {
-        std::vector<Vertex3> vertices;
-        std::vector<unsigned int> indices;
-        load_obj(BALL_OBJ_FILE, DATA_DIRECTORY, vertices, indices);
-        glm::vec3 min_bound, max_bound;
-        calc_bounds(min_bound, max_bound, vertices);
-        float radius = calc_radius(min_bound, max_bound);
-        m_to_center  = calc_center(min_bound, max_bound);
-        m_scale      = RADIUS / radius;
-        init_vao3(vertices, indices);
-        build_shader_program(RENDER_VERT_SHADER_FILE, RENDER_FRAG_SHADER_FILE);
+    // Returns the buffer offset of the committed bytes
+    GLintptr commit(GLsizeiptr size) {
+        const GLintptr offset = segment_base() + m_reserved;
+        if (!m_persistent) {
+            if (g_gl_state.has_dsa()) {
+                glNamedBufferSubData(m_buffer.get(), offset, size, m_mapped + offset);
+            } else {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer.get());
+                glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, m_mapped + offset);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                g_gl_state.count_calls(2);
+            }
+            g_gl_state.count_calls(1);
+        }
+        m_head = m_reserved + size;
+        return offset;
     }
 
-    void draw_before_starting() {
-        glm::mat4 trans_mat;
-        trans_mat         = glm::mat4(1.0f);
-        trans_mat         = glm::translate(trans_mat, glm::vec3(0.0f, m_falling_pos, 0.0f));
-        glm::mat4 adj_mat = calc_adj_mat();
-
-        glm::mat4 mv_mat    = g_view_mat * trans_mat * adj_mat;
-        glm::mat4 mvp_mat   = g_proj_mat * g_view_mat * trans_mat * adj_mat;
-        glm::mat4 norm_mat  = glm::transpose(glm::inverse(mv_mat));
-        glm::mat4 light_mat = g_view_mat;
-
-        draw_elements3(mv_mat, mvp_mat, norm_mat, light_mat, LIGHT_POS, SHININESS);
+    GLintptr write(const void* data, GLsizeiptr size, GLsizeiptr alignment) {
+        std::memcpy(reserve(size, alignment), data, size);
+        return commit(size);
     }
 
-    void draw_during_game() {
-        glm::vec3 last_pos  = get_pos_from_idx(m_last_pos_idx);
-        glm::mat4 model_mat = glm::mat4(1.0f);
+    GLuint get_id() const {
+        return m_buffer.get();
+    }
 
-        model_mat = glm::translate(model_mat, m_rotation_center);
-        model_mat = glm::rotate(model_mat, glm::radians(m_rev_angle), m_rotation_axis);
-        model_mat = glm::translate(model_mat, last_pos - m_rotation_center);
-        model_mat = glm::rotate(model_mat, glm::radians(-m_rev_angle), m_rotation_axis);
-        model_mat = glm::rotate(model_mat, glm::radians(m_rot_angle), glm::vec3(1.0f, 0.0f, 0.0f));
-        model_mat = model_mat * calc_adj_mat();
+    GLsizeiptr get_uniform_alignment() const {
+        return m_uniform_alignment;
+    }
 
-        glm::mat4 mv_mat    = g_view_mat * model_mat;
-        glm::mat4 mvp_mat   = g_proj_mat * g_view_mat * model_mat;
-        glm::mat4 norm_mat  = glm::transpose(glm::inverse(mv_mat));
-        glm::mat4 light_mat = g_view_mat;
+    bool is_persistent() const {
+        return m_persistent;
+    }
 
-        draw_elements3(mv_mat, mvp_mat, norm_mat, light_mat, LIGHT_POS, SHININESS);
+    // Changes whenever the buffer is replaced, so that vertex arrays sourcing it can follow
+    int get_generation() const {
+        return m_generation;
     }
 
-    void update_fall() {
-        m_falling_pos -= 0.1f;
+    // Time the CPU was blocked on the GPU at the start of the current frame
+    double get_wait_ms() const {
+        return m_last_wait_s * 1000.0;
     }
 
-    void update_juggle() {
-        m_rot_angle += m_rot_angular_vel;
-        if (m_rot_angle >= 360.0f) {
-            m_rot_angle = 0.0f;
-        }
-        m_rev_angle += m_rev_angular_vel;
+    double get_max_wait_ms() const {
+        return m_max_wait_s * 1000.0;
     }
 
    private:
-    // Matrix to adjust the scale and position of the ball
-    glm::mat4 calc_adj_mat() const {
-        glm::mat4 adj_mat = glm::mat4(1.0f);
-        adj_mat           = glm::rotate(adj_mat, glm::radians(20.0f), glm::vec3(0.0f, 1.0f, 0.5f));
-        adj_mat           = glm::scale(adj_mat, glm::vec3(m_scale));
-        adj_mat           = glm::translate(adj_mat, -m_to_center);
-        return adj_mat;
+    static constexpr int STREAM_SEGMENTS = 3;
+
+    GLsizeiptr segment_base() const {
+        return m_segment * m_segment_size;
     }
 
-    static void calc_bounds(glm::vec3& min_bound, glm::vec3& max_bound,
-                            const std::vector<Vertex3>& vertices) {
-        float large_val = 100000.0f;
-        min_bound       = glm::vec3(+large_val);
-        max_bound       = glm::vec3(-large_val);
-        for (const auto& v : vertices) {
-            for (int i = 0; i < 3; ++i) {
-                min_bound[i] = std::min(min_bound[i], v.position[i]);
-                max_bound[i] = std::max(max_bound[i], v.position[i]);
-            }
+    // Draws issued earlier in the frame still read the old buffer, which GL keeps alive until
+    // they are done, so the rest of the frame continues at the start of the new one
+    void grow(GLsizeiptr segment_size) {
+        release();
+        init(segment_size);
+        m_segment = 0;
+        m_head    = 0;
+        m_generation++;
+        if (g_verbose) {
+            printf("Stream buffer grown to %ld bytes per frame\n", (long)segment_size);
         }
     }
 
-    static float calc_radius(const glm::vec3& min_bound, const glm::vec3& max_bound) {
-        return (max_bound.x - min_bound.x) * 0.5f;
+    void orphan() {
+        if (g_gl_state.has_dsa()) {
+            glNamedBufferData(m_buffer.get(), m_segment_size, NULL, GL_STREAM_DRAW);
+        } else {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer.get());
+            glBufferData(GL_COPY_WRITE_BUFFER, m_segment_size, NULL, GL_STREAM_DRAW);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            g_gl_state.count_calls(2);
+        }
+        g_gl_state.count_calls(1);
     }
 
-    static glm::vec3 calc_center(const glm::vec3& min_bound, const glm::vec3& max_bound) {
-        return (min_bound + max_bound) * 0.5f;
-    }
+    GLHandle m_buffer;
+    GLsizeiptr m_segment_size        = 0;
+    GLsizeiptr m_uniform_alignment   = 256;
+    bool m_persistent                = false;
+    unsigned char* m_mapped          = nullptr;
+    std::vector<unsigned char> m_shadow;  // stands in for the mapping without buffer storage
+    GLsync m_fences[STREAM_SEGMENTS] = {};
+    int m_segment                    = 0;
+    GLsizeiptr m_head                = 0;
+    GLsizeiptr m_reserved            = 0;
+    double m_last_wait_s             = 0.0;
+    double m_max_wait_s              = 0.0;
+    int m_generation                 = 0;
+};
 
-    static int get_random_next_pos_idx(int last_pos_idx) {
-        int result;
-        while (1) {
-            result = rand() % 9;
-            if (result != last_pos_idx) {
-                return result;
+static StreamBuffer g_stream_buffer;
+
+// GL objects of one piece of geometry. center and radius bound the vertices in mesh coordinates,
+// and adj_mat maps those to the object placed by the Transform of an entity.
+struct Mesh {
+    GLHandle vao;
+    GLHandle vbo;
+    GLHandle ibo;
+    GLsizei num_indices = 0;
+    GLenum mode         = GL_TRIANGLES;
+    glm::mat4 adj_mat   = glm::mat4(1.0f);
+    glm::vec3 center    = glm::vec3(0.0f);
+    float radius        = 0.0f;
+};
+
+// Each shading selects the PerDraw layout filled for the material's program
+enum class Shading {
+    COLOR,     // vertex colors, DrawConstants1
+    TEXTURE,   // texture, DrawConstants1
+    LIT,       // lit vertex colors, DrawConstants3
+    IMPOSTOR,  // ray-traced spheres, ImpostorConstants
+};
+
+struct Material {
+    Shading shading = Shading::COLOR;
+    GLHandle program;
+    GLHandle texture;
+    GLenum texture_target = GL_TEXTURE_2D;
+};
+
+// Contents of the asset at name, relative to the repository root. The copy embedded in the binary
+// is used unless --asset-dir is given; assets that were not embedded are read from
+// DEFAULT_ASSET_DIRECTORY.
+std::string load_asset(const std::string& name) {
+#ifdef EMBED_ASSETS
+    if (g_asset_dir.empty()) {
+        for (const EmbeddedAsset& asset : EMBEDDED_ASSETS) {
+            if (name == asset.name) {
+                return std::string((const char*)asset.data, asset.size);
             }
         }
     }
+#endif
+    const std::string path = (g_asset_dir.empty() ? DEFAULT_ASSET_DIRECTORY : g_asset_dir) + name;
+    std::ifstream reader(path.c_str(), std::ios::in | std::ios::binary);
+    if (!reader.is_open()) {
+        fprintf(stderr, "Failed to load an asset: %s\n", path.c_str());
+        std::exit(1);
+    }
+    return std::string(std::istreambuf_iterator<char>(reader), std::istreambuf_iterator<char>());
+}
 
-    static float get_random_rev_angular_vel() {
-        const int num = rand();
-        switch (num % 4) {
-            case 0:
-                return 2.25f;
-                break;
-            case 1:
-                return 2.5f;
-                break;
-            case 2:
-                return 3.0f;
-                break;
-            case 3:
-                return 3.6f;
-                break;
-            default:
-                fprintf(stderr, "Bug in 'get_random_rev_angular_vel'");
-                std::exit(1);
-                break;
+GLuint compile_shader(const std::string& filename, GLuint type) {
+    GLuint shader_id = glCreateShader(type);
+
+    const std::string code = load_asset(filename);
+
+    const char* code_chars = code.c_str();
+    glShaderSource(shader_id, 1, &code_chars, NULL);
+    glCompileShader(shader_id);
+
+    GLint compile_status;
+    glGetShaderiv(shader_id, GL_COMPILE_STATUS, &compile_status);
+    if (compile_status == GL_FALSE) {
+        fprintf(stderr, "Failed to compile a shader!\n");
+
+        GLint log_length;
+        glGetShaderiv(shader_id, GL_INFO_LOG_LENGTH, &log_length);
+        if (log_length > 0) {
+            GLsizei length;
+            std::string err_msg;
+            err_msg.resize(log_length);
+            glGetShaderInfoLog(shader_id, log_length, &length, &err_msg[0]);
+
+            fprintf(stderr, "[ ERROR ] %s\n", err_msg.c_str());
+            fprintf(stderr, "%s\n", code.c_str());
         }
+        std::exit(1);
     }
 
-    static float get_random_rot_angular_vel() {
-        const int num = rand();
-        switch (num % 4) {
-            case 0:
-                return 1.0f;
-                break;
-            case 1:
-                return 5.0f;
-                break;
-            case 2:
-                return 10.0f;
-                break;
-            case 3:
-                return 20.0f;
-                break;
-            default:
-                fprintf(stderr, "Bug in 'get_random_rot_angular_vel'");
-                std::exit(1);
-                break;
+    return shader_id;
+}
+
+GLHandle build_shader_program(const std::string& vert_shader_file,
+                              const std::string& frag_shader_file) {
+    GLuint vert_shader_id = compile_shader(vert_shader_file, GL_VERTEX_SHADER);
+    GLuint frag_shader_id = compile_shader(frag_shader_file, GL_FRAGMENT_SHADER);
+
+    GLHandle program = GLHandle::create(GLObjectType::PROGRAM, GpuCategory::PROGRAM, 0);
+    glAttachShader(program.get(), vert_shader_id);
+    glAttachShader(program.get(), frag_shader_id);
+    glLinkProgram(program.get());
+
+    GLint link_state;
+    glGetProgramiv(program.get(), GL_LINK_STATUS, &link_state);
+    if (link_state == GL_FALSE) {
+        fprintf(stderr, "Failed to link shaders!\n");
+
+        GLint log_length;
+        glGetProgramiv(program.get(), GL_INFO_LOG_LENGTH, &log_length);
+        if (log_length > 0) {
+            GLsizei length;
+            std::string err_msg;
+            err_msg.resize(log_length);
+            glGetProgramInfoLog(program.get(), log_length, &length, &err_msg[0]);
+
+            fprintf(stderr, "[ ERROR ] %s\n", err_msg.c_str());
         }
+        std::exit(1);
     }
 
-    static glm::vec3 get_pos_from_idx(int idx) {
-        return CELL_POS[idx];
+    // The program keeps the compiled code; the shader objects are no longer needed
+    glDetachShader(program.get(), vert_shader_id);
+    glDetachShader(program.get(), frag_shader_id);
+    glDeleteShader(vert_shader_id);
+    glDeleteShader(frag_shader_id);
+
+    const GLuint block_index = glGetUniformBlockIndex(program.get(), "PerDraw");
+    if (block_index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program.get(), block_index, PER_DRAW_BINDING);
     }
+    const GLint texture_location = glGetUniformLocation(program.get(), "u_texture");
+    if (texture_location >= 0) {
+        g_gl_state.use_program(program.get());
+        glUniform1i(texture_location, 0);
+    }
+    return program;
+}
 
-    void calc_rotation() {
-        glm::vec3 next_pos  = get_pos_from_idx(m_next_pos_idx);
-        glm::vec3 last_pos  = get_pos_from_idx(m_last_pos_idx);
-        glm::vec3 direction = next_pos - last_pos;
-        m_rotation_axis     = glm::cross(direction, glm::vec3(0.0f, -1.0f, 0.0f));
-        m_rotation_center   = (last_pos + next_pos) * 0.5f;
+// Upload RGBA8 pixels to a new texture
+GLHandle create_texture(const unsigned char* bytes, int tex_width, int tex_height, GLint filter,
+                        GLint wrap) {
+    GLHandle texture = GLHandle::create(GLObjectType::TEXTURE, GpuCategory::TEXTURE,
+                                        (long long)tex_width * tex_height * 4, GL_TEXTURE_2D);
+    if (g_gl_state.has_dsa()) {
+        glTextureStorage2D(texture.get(), 1, GL_RGBA8, tex_width, tex_height);
+        glTextureSubImage2D(texture.get(), 0, 0, 0, tex_width, tex_height, GL_RGBA,
+                            GL_UNSIGNED_BYTE, bytes);
+
+        glTextureParameteri(texture.get(), GL_TEXTURE_MAG_FILTER, filter);
+        glTextureParameteri(texture.get(), GL_TEXTURE_MIN_FILTER, filter);
+
+        glTextureParameteri(texture.get(), GL_TEXTURE_WRAP_S, wrap);
+        glTextureParameteri(texture.get(), GL_TEXTURE_WRAP_T, wrap);
+        return texture;
     }
 
-   private:
-    float m_falling_pos;
+    g_gl_state.bind_texture(0, GL_TEXTURE_2D, texture.get());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width, tex_height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 bytes);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    return texture;
+}
+
+GLHandle load_texture(const std::string& filename) {
+    const std::string file = load_asset(filename);
+    int tex_width, tex_height, channels;
+    unsigned char* bytes
+        = stbi_load_from_memory((const stbi_uc*)file.data(), (int)file.size(), &tex_width,
+                                &tex_height, &channels, STBI_rgb_alpha);
+    if (!bytes) {
+        fprintf(stderr, "Failed to load image file: %s\n", filename.c_str());
+        std::exit(1);
+    }
+
+    GLHandle texture = create_texture(bytes, tex_width, tex_height, GL_LINEAR, GL_REPEAT);
+
+    stbi_image_free(bytes);
+    return texture;
+}
+
+// Upload six RGBA8 faces of size x size pixels, in GL_TEXTURE_CUBE_MAP_POSITIVE_X order
+GLHandle create_cube_texture(const std::vector<unsigned char>& faces, int size) {
+    const size_t face_bytes = (size_t)size * size * 4;
+    GLHandle texture        = GLHandle::create(GLObjectType::TEXTURE, GpuCategory::TEXTURE,
+                                               (long long)face_bytes * 6, GL_TEXTURE_CUBE_MAP);
+    if (g_gl_state.has_dsa()) {
+        glTextureStorage2D(texture.get(), 1, GL_RGBA8, size, size);
+        for (int face = 0; face < 6; ++face) {
+            glTextureSubImage3D(texture.get(), 0, 0, 0, face, size, size, 1, GL_RGBA,
+                                GL_UNSIGNED_BYTE, &faces[face * face_bytes]);
+        }
+        glTextureParameteri(texture.get(), GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(texture.get(), GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        return texture;
+    }
+
+    g_gl_state.bind_texture(0, GL_TEXTURE_CUBE_MAP, texture.get());
+    for (int face = 0; face < 6; ++face) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, size, size, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, &faces[face * face_bytes]);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+// mtl_file provides the materials for the mtllib statement of obj_file
+void load_obj(const std::string& obj_file, const std::string& mtl_file,
+              std::vector<Vertex3>& vertices, std::vector<unsigned int>& indices) {
+    tinyobj::ObjReaderConfig reader_config;
+    tinyobj::ObjReader reader;
+    if (!reader.ParseFromString(load_asset(obj_file), load_asset(mtl_file), reader_config)) {
+        if (!reader.Error().empty()) {
+            fprintf(stderr, "TinyObjReader: %s", reader.Error().c_str());
+        }
+        std::exit(1);
+    }
+    // if (!reader.Warning().empty()) {
+    //     printf("TinyObjReader: %s", reader.Warning().c_str());
+    // }
+
+    auto& attrib    = reader.GetAttrib();
+    auto& shapes    = reader.GetShapes();
+    auto& materials = reader.GetMaterials();
+
+    for (size_t s = 0; s < shapes.size(); s++) {
+        size_t index_offset = 0;
+        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+            size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
+            for (size_t v = 0; v < fv; v++) {
+                glm::vec3 position, normal, diffuse;
+                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+                position = glm::vec3(attrib.vertices[3 * size_t(idx.vertex_index) + 0],
+                                     attrib.vertices[3 * size_t(idx.vertex_index) + 1],
+                                     attrib.vertices[3 * size_t(idx.vertex_index) + 2]);
+                if (idx.normal_index >= 0) {
+                    normal = glm::vec3(attrib.normals[3 * size_t(idx.normal_index) + 0],
+                                       attrib.normals[3 * size_t(idx.normal_index) + 1],
+                                       attrib.normals[3 * size_t(idx.normal_index) + 2]);
+                }
+                diffuse = glm::vec3(materials[shapes[s].mesh.material_ids[f]].diffuse[0],
+                                    materials[shapes[s].mesh.material_ids[f]].diffuse[1],
+                                    materials[shapes[s].mesh.material_ids[f]].diffuse[2]);
+
+                indices.push_back((unsigned int)vertices.size());
+                vertices.push_back(Vertex3(position, normal, diffuse));
+            }
+            index_offset += fv;
+        }
+    }
+}
+
+// Without DSA the buffer is bound to GL_COPY_WRITE_BUFFER, which is not VAO state
+GLHandle create_buffer(GLsizeiptr size, const void* data, GLenum usage, GpuCategory category) {
+    GLHandle buffer = GLHandle::create(GLObjectType::BUFFER, category, size);
+    if (g_gl_state.has_dsa()) {
+        glNamedBufferData(buffer.get(), size, data, usage);
+    } else {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.get());
+        glBufferData(GL_COPY_WRITE_BUFFER, size, data, usage);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    return buffer;
+}
+
+// Vertex array sourcing float attributes from vbo and indices from ibo
+GLHandle create_vertex_array(GLuint vbo, GLuint ibo, GLsizei stride, const VertexAttrib* attribs,
+                             int num_attribs) {
+    GLHandle vao = GLHandle::create(GLObjectType::VERTEX_ARRAY, GpuCategory::VERTEX_ARRAY, 0);
+    if (g_gl_state.has_dsa()) {
+        glVertexArrayVertexBuffer(vao.get(), 0, vbo, 0, stride);
+        for (int i = 0; i < num_attribs; ++i) {
+            glEnableVertexArrayAttrib(vao.get(), attribs[i].index);
+            glVertexArrayAttribFormat(vao.get(), attribs[i].index, attribs[i].size, GL_FLOAT,
+                                      GL_FALSE, attribs[i].offset);
+            glVertexArrayAttribBinding(vao.get(), attribs[i].index, 0);
+        }
+        glVertexArrayElementBuffer(vao.get(), ibo);
+        return vao;
+    }
+
+    g_gl_state.bind_vertex_array(vao.get());
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    for (int i = 0; i < num_attribs; ++i) {
+        glEnableVertexAttribArray(attribs[i].index);
+        glVertexAttribPointer(attribs[i].index, attribs[i].size, GL_FLOAT, GL_FALSE, stride,
+                              (void*)(size_t)attribs[i].offset);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return vao;
+}
+
+GLHandle create_index_buffer(const std::vector<unsigned int>& indices) {
+    return create_buffer(sizeof(unsigned int) * indices.size(), indices.data(), GL_STATIC_DRAW,
+                         GpuCategory::INDEX_BUFFER);
+}
+
+// Mesh of the vertices and indices, bounded by the vertex positions
+template <typename Vertex>
+Mesh create_mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                 GLenum mode, const VertexAttrib* attribs, int num_attribs) {
+    Mesh mesh;
+    mesh.vbo         = create_buffer(sizeof(Vertex) * vertices.size(), vertices.data(),
+                                     GL_STATIC_DRAW, GpuCategory::VERTEX_BUFFER);
+    mesh.ibo         = create_index_buffer(indices);
+    mesh.vao         = create_vertex_array(mesh.vbo.get(), mesh.ibo.get(), sizeof(Vertex), attribs,
+                                           num_attribs);
+    mesh.num_indices = (GLsizei)indices.size();
+    mesh.mode        = mode;
+
+    glm::vec3 min_bound = glm::vec3(+FLT_MAX);
+    glm::vec3 max_bound = glm::vec3(-FLT_MAX);
+    for (const Vertex& v : vertices) {
+        min_bound = glm::min(min_bound, v.position);
+        max_bound = glm::max(max_bound, v.position);
+    }
+    mesh.center = (min_bound + max_bound) * 0.5f;
+    for (const Vertex& v : vertices) {
+        mesh.radius = std::max(mesh.radius, glm::length(v.position - mesh.center));
+    }
+    return mesh;
+}
+
+Mesh create_mesh1(const std::vector<Vertex1>& vertices, const std::vector<unsigned int>& indices,
+                  GLenum mode) {
+    const VertexAttrib attribs[] = {
+        {0, 3, offsetof(Vertex1, position)},
+        {1, 3, offsetof(Vertex1, color)},
+    };
+    return create_mesh(vertices, indices, mode, attribs, 2);
+}
+
+Mesh create_mesh2(const std::vector<Vertex2>& vertices, const std::vector<unsigned int>& indices,
+                  GLenum mode) {
+    const VertexAttrib attribs[] = {
+        {0, 3, offsetof(Vertex2, position)},
+        {1, 2, offsetof(Vertex2, texcoord)},
+    };
+    return create_mesh(vertices, indices, mode, attribs, 2);
+}
+
+Mesh create_mesh3(const std::vector<Vertex3>& vertices, const std::vector<unsigned int>& indices,
+                  GLenum mode) {
+    const VertexAttrib attribs[] = {
+        {0, 3, offsetof(Vertex3, position)},
+        {1, 3, offsetof(Vertex3, normal)},
+        {2, 3, offsetof(Vertex3, diffuse)},
+    };
+    return create_mesh(vertices, indices, mode, attribs, 3);
+}
+
+Material create_material(Shading shading, const std::string& vert_shader_file,
+                         const std::string& frag_shader_file, GLHandle texture = GLHandle(),
+                         GLenum texture_target = GL_TEXTURE_2D) {
+    Material material;
+    material.shading        = shading;
+    material.program        = build_shader_program(vert_shader_file, frag_shader_file);
+    material.texture        = std::move(texture);
+    material.texture_target = texture_target;
+    return material;
+}
+
+// Stream the constants for the next draw and bind them to PER_DRAW_BINDING. Only the first
+// used_size bytes are copied, but the bound range covers the whole block, as GL requires.
+void bind_draw_constants(const void* constants, GLsizeiptr size, GLsizeiptr used_size) {
+    void* data = g_stream_buffer.reserve(size, g_stream_buffer.get_uniform_alignment());
+    std::memcpy(data, constants, used_size);
+    const GLintptr offset = g_stream_buffer.commit(size);
+    g_gl_state.bind_uniform_range(PER_DRAW_BINDING, g_stream_buffer.get_id(), offset, size);
+}
+
+void bind_draw_constants(const void* constants, GLsizeiptr size) {
+    bind_draw_constants(constants, size, size);
+}
+
+// Center of cell (x, z) of a square grid around the origin, laid out like CELL_POS
+glm::vec3 get_cell_pos(int x, int z, int cells_per_side) {
+    const float offset = (cells_per_side - 1) * 0.5f;
+    return glm::vec3((x - offset) * 2.0f, 0.0f, (z - offset) * 2.0f);
+}
+
+// Unit square textured with grass, placed by the Transform of the ground entity
+Mesh create_ground_mesh() {
+    unsigned int idx = 0;
+    std::vector<Vertex2> vertices;
+    std::vector<unsigned int> indices;
+    for (int i = 0; i < 3; i++) {
+        Vertex2 v(UNIT_RECTANGLE_POS[UNIT_RECTANGLE_INDEX[0][i]],
+                  6.0f * UNIT_RECTANGLE_UV[UNIT_RECTANGLE_INDEX[0][i]]);
+        vertices.push_back(v);
+        indices.push_back(idx++);
+    }
+    for (int i = 0; i < 3; i++) {
+        Vertex2 v(UNIT_RECTANGLE_POS[UNIT_RECTANGLE_INDEX[1][i]],
+                  6.0f * UNIT_RECTANGLE_UV[UNIT_RECTANGLE_INDEX[1][i]]);
+        vertices.push_back(v);
+        indices.push_back(idx++);
+    }
+    return create_mesh2(vertices, indices, GL_TRIANGLES);
+}
+
+Mesh create_grid_mesh(int cells_per_side) {
+    unsigned int idx = 0;
+    std::vector<Vertex1> vertices;
+    std::vector<unsigned int> indices;
+    int index_four[5] = {
+        0, 1, 2, 3, 0,
+    };
+    for (int j = 0; j < cells_per_side * cells_per_side; ++j) {
+        const glm::vec3 center
+            = get_cell_pos(j % cells_per_side, j / cells_per_side, cells_per_side)
+              + glm::vec3(0.0f, -RADIUS, 0.0f);
+        for (int i = 0; i < 4; ++i) {
+            for (int k = 0; k < 2; ++k) {
+                glm::vec3 pos = UNIT_RECTANGLE_POS[index_four[i + k]] + center;
+                Vertex1 v(pos, WHITE);
+                vertices.push_back(v);
+                indices.push_back(idx++);
+            }
+        }
+    }
+    return create_mesh1(vertices, indices, GL_LINES);
+}
+
+Mesh create_tile_mesh(const glm::vec3& color) {
+    unsigned int idx = 0;
+    std::vector<Vertex1> vertices;
+    std::vector<unsigned int> indices;
+    for (int i = 0; i < 3; i++) {
+        Vertex1 v(UNIT_RECTANGLE_POS[UNIT_RECTANGLE_INDEX[0][i]], color);
+        vertices.push_back(v);
+        indices.push_back(idx++);
+    }
+    for (int i = 0; i < 3; i++) {
+        Vertex1 v(UNIT_RECTANGLE_POS[UNIT_RECTANGLE_INDEX[1][i]], color);
+        vertices.push_back(v);
+        indices.push_back(idx++);
+    }
+    return create_mesh1(vertices, indices, GL_TRIANGLES);
+}
+
+// Direction of texel (sc, tc) in [-1, 1]^2 of a cube map face, as defined by the GL spec
+glm::vec3 cube_face_direction(int face, float sc, float tc) {
+    switch (face) {
+        case 0:
+            return glm::vec3(1.0f, -tc, -sc);
+        case 1:
+            return glm::vec3(-1.0f, -tc, sc);
+        case 2:
+            return glm::vec3(sc, 1.0f, tc);
+        case 3:
+            return glm::vec3(sc, -1.0f, -tc);
+        case 4:
+            return glm::vec3(sc, -tc, 1.0f);
+        default:
+            return glm::vec3(-sc, -tc, -1.0f);
+    }
+}
+
+// Bake the diffuse colors of the mesh into a cube map around center. Each texel takes the color of
+// the triangle whose centroid lies closest to the texel's direction.
+void bake_pattern_cube(const std::vector<Vertex3>& vertices, const glm::vec3& center, int size,
+                       std::vector<unsigned char>& faces) {
+    std::vector<glm::vec3> directions, colors;
+    for (size_t i = 0; i + 2 < vertices.size(); i += 3) {
+        const glm::vec3 centroid
+            = (vertices[i].position + vertices[i + 1].position + vertices[i + 2].position) / 3.0f;
+        directions.push_back(glm::normalize(centroid - center));
+        colors.push_back(vertices[i].diffuse);
+    }
+
+    faces.resize((size_t)6 * size * size * 4);
+    unsigned char* texel = faces.data();
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                const float sc      = 2.0f * (x + 0.5f) / size - 1.0f;
+                const float tc      = 2.0f * (y + 0.5f) / size - 1.0f;
+                const glm::vec3 dir = glm::normalize(cube_face_direction(face, sc, tc));
+
+                size_t best    = 0;
+                float best_dot = -2.0f;
+                for (size_t i = 0; i < directions.size(); ++i) {
+                    const float d = glm::dot(dir, directions[i]);
+                    if (d > best_dot) {
+                        best_dot = d;
+                        best     = i;
+                    }
+                }
+
+                const glm::vec3 color = directions.empty() ? WHITE : colors[best];
+                for (int c = 0; c < 3; ++c) {
+                    texel[c] = (unsigned char)(glm::clamp(color[c], 0.0f, 1.0f) * 255.0f);
+                }
+                texel[3] = 255;
+                texel += 4;
+            }
+        }
+    }
+}
+
+// The football model, drawn as a lit mesh or, with --ball-impostor, as a ray-traced quad that
+// samples a cube map baked from the mesh colors. Either way the mesh is bounded by the sphere of
+// the model and adj_mat scales it to RADIUS around the origin.
+void load_ball(Mesh& mesh, Material& material) {
+    std::vector<Vertex3> vertices;
+    std::vector<unsigned int> indices;
+    load_obj(BALL_OBJ_FILE, BALL_MTL_FILE, vertices, indices);
+
+    glm::vec3 min_bound = glm::vec3(+FLT_MAX);
+    glm::vec3 max_bound = glm::vec3(-FLT_MAX);
+    for (const Vertex3& v : vertices) {
+        min_bound = glm::min(min_bound, v.position);
+        max_bound = glm::max(max_bound, v.position);
+    }
+    const glm::vec3 to_center = (min_bound + max_bound) * 0.5f;
+    const float radius        = (max_bound.x - min_bound.x) * 0.5f;
+
+    if (g_use_ball_impostor) {
+        std::vector<unsigned char> faces;
+        bake_pattern_cube(vertices, to_center, PATTERN_CUBE_SIZE, faces);
+        material = create_material(Shading::IMPOSTOR, IMPOSTOR_VERT_SHADER_FILE,
+                                   IMPOSTOR_FRAG_SHADER_FILE,
+                                   create_cube_texture(faces, PATTERN_CUBE_SIZE),
+                                   GL_TEXTURE_CUBE_MAP);
+
+        const std::vector<glm::vec2> corners = {glm::vec2(-1.0f, -1.0f), glm::vec2(1.0f, -1.0f),
+                                                glm::vec2(1.0f, 1.0f), glm::vec2(-1.0f, 1.0f)};
+        const VertexAttrib attribs[]         = {{0, 2, 0}};
+        mesh.vbo         = create_buffer(sizeof(glm::vec2) * corners.size(), corners.data(),
+                                         GL_STATIC_DRAW, GpuCategory::VERTEX_BUFFER);
+        mesh.ibo         = create_index_buffer({0, 1, 2, 2, 3, 0});
+        mesh.vao         = create_vertex_array(mesh.vbo.get(), mesh.ibo.get(), sizeof(glm::vec2),
+                                               attribs, 1);
+        mesh.num_indices = 6;
+        mesh.mode        = GL_TRIANGLES;
+    } else {
+        material = create_material(Shading::LIT, RENDER_VERT_SHADER_FILE, RENDER_FRAG_SHADER_FILE);
+        mesh     = create_mesh3(vertices, indices, GL_TRIANGLES);
+    }
+
+    glm::mat4 adj_mat = glm::mat4(1.0f);
+    adj_mat           = glm::rotate(adj_mat, glm::radians(20.0f), glm::vec3(0.0f, 1.0f, 0.5f));
+    adj_mat           = glm::scale(adj_mat, glm::vec3(RADIUS / radius));
+    adj_mat           = glm::translate(adj_mat, -to_center);
+    mesh.adj_mat      = adj_mat;
+    mesh.center       = to_center;
+    mesh.radius       = radius;
+}
+
+enum class GameState {
+    BEFORE_START,
+    FALLING,
+    JUGGLING,
+    FAILED,
+};
+
+// Flight of the ball between the cells, kept apart from the scene so that sessions without a
+// window can simulate it. Each instance draws from its own random engine.
+class BallMotion {
+   public:
+    BallMotion() {
+        reset();
+    }
+
+    void seed(unsigned int seed) {
+        m_rng.seed(seed);
+    }
+
+    float get_falling_pos() const {
+        return m_falling_pos;
+    }
+
+    bool is_fallen() const {
+        return m_rev_angle >= 180.0f;
+    }
+
+    int get_next_pos_idx() const {
+        return m_next_pos_idx;
+    }
+
+    void set_dest() {
+        m_last_pos_idx    = m_next_pos_idx;
+        m_rev_angle       = 0.0f;
+        m_next_pos_idx    = get_random_next_pos_idx(m_last_pos_idx);
+        m_rev_angular_vel = get_random_rev_angular_vel();
+        m_rot_angular_vel = get_random_rot_angular_vel();
+        calc_rotation();
+    }
+
+    void reset() {
+        m_falling_pos     = INITIAL_POS;
+        m_last_pos_idx    = 4;
+        m_next_pos_idx    = 4;
+        m_rot_angle       = 0.0f;
+        m_rev_angle       = 0.0f;
+        m_rot_angular_vel = 1.0f;
+        m_rev_angular_vel = 2.25f;
+    }
+
+    void update_fall() {
+        m_falling_pos -= 0.1f;
+    }
+
+    void update_juggle() {
+        m_rot_angle += m_rot_angular_vel;
+        if (m_rot_angle >= 360.0f) {
+            m_rot_angle = 0.0f;
+        }
+        m_rev_angle += m_rev_angular_vel;
+    }
+
+    // Placement of the ball center before it reaches the grid
+    glm::mat4 calc_falling_mat() const {
+        return glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, m_falling_pos, 0.0f));
+    }
+
+    // Placement of the ball center on its arc from the last cell to the next one
+    glm::mat4 calc_juggling_mat() const {
+        glm::vec3 last_pos  = get_pos_from_idx(m_last_pos_idx);
+        glm::mat4 model_mat = glm::mat4(1.0f);
+
+        model_mat = glm::translate(model_mat, m_rotation_center);
+        model_mat = glm::rotate(model_mat, glm::radians(m_rev_angle), m_rotation_axis);
+        model_mat = glm::translate(model_mat, last_pos - m_rotation_center);
+        model_mat = glm::rotate(model_mat, glm::radians(-m_rev_angle), m_rotation_axis);
+        model_mat = glm::rotate(model_mat, glm::radians(m_rot_angle), glm::vec3(1.0f, 0.0f, 0.0f));
+        return model_mat;
+    }
+
+   private:
+    int get_random_next_pos_idx(int last_pos_idx) {
+        int result;
+        while (1) {
+            result = m_rng() % 9;
+            if (result != last_pos_idx) {
+                return result;
+            }
+        }
+    }
+
+    float get_random_rev_angular_vel() {
+        const unsigned int num = m_rng();
+        switch (num % 4) {
+            case 0:
+                return 2.25f;
+                break;
+            case 1:
+                return 2.5f;
+                break;
+            case 2:
+                return 3.0f;
+                break;
+            case 3:
+                return 3.6f;
+                break;
+            default:
+                fprintf(stderr, "Bug in 'get_random_rev_angular_vel'");
+                std::exit(1);
+                break;
+        }
+    }
+
+    float get_random_rot_angular_vel() {
+        const unsigned int num = m_rng();
+        switch (num % 4) {
+            case 0:
+                return 1.0f;
+                break;
+            case 1:
+                return 5.0f;
+                break;
+            case 2:
+                return 10.0f;
+                break;
+            case 3:
+                return 20.0f;
+                break;
+            default:
+                fprintf(stderr, "Bug in 'get_random_rot_angular_vel'");
+                std::exit(1);
+                break;
+        }
+    }
+
+    static glm::vec3 get_pos_from_idx(int idx) {
+        return CELL_POS[idx];
+    }
+
+    void calc_rotation() {
+        glm::vec3 next_pos  = get_pos_from_idx(m_next_pos_idx);
+        glm::vec3 last_pos  = get_pos_from_idx(m_last_pos_idx);
+        glm::vec3 direction = next_pos - last_pos;
+        m_rotation_axis     = glm::cross(direction, glm::vec3(0.0f, -1.0f, 0.0f));
+        m_rotation_center   = (last_pos + next_pos) * 0.5f;
+    }
+
+   private:
+    float m_falling_pos;
 
     int m_last_pos_idx;
     int m_next_pos_idx;
@@ -765,105 +1670,1773 @@ class Ball : public RenderObject {
     float m_rot_angular_vel;
     float m_rev_angular_vel;
 
-    glm::vec3 m_to_center;
-    float m_scale;
-
     glm::vec3 m_rotation_axis;
     glm::vec3 m_rotation_center;
+
+    std::minstd_rand m_rng;
 };
 
-class GameManager {
+// What a tick of a session did, so that the owner can report it
+enum class GameEvent {
+    NONE,
+    SCORED,
+    FAILED,
+};
+
+// Rules of one game: the ball, the tile the player moves and the score. It owns no GL objects,
+// so the window and the server can both run it.
+class GameSession {
    public:
-    GameManager()
-        : m_game_state(GameState::BEFORE_START), m_tile(WHITE), m_red_tile(RED), m_count(0) {}
+    void seed(unsigned int seed) {
+        m_motion.seed(seed);
+    }
+
+    GameState get_game_state() const {
+        return m_game_state;
+    }
+
+    int get_score() const {
+        return m_count;
+    }
+
+    int get_tile_pos_idx() const {
+        return m_tile_pos_idx;
+    }
+
+    // Cell index the ball is flying to
+    int get_ball_target() const {
+        return m_motion.get_next_pos_idx();
+    }
+
+    const BallMotion& get_motion() const {
+        return m_motion;
+    }
+
+    // Apply a key press. Returns whether the session changed.
+    bool key_press(int key) {
+        if (m_game_state == GameState::JUGGLING) {
+            for (int i = 0; i < 9; ++i) {
+                if (key == CELL_KEYS[i] && m_tile_pos_idx != i) {
+                    m_tile_pos_idx = i;
+                    return true;
+                }
+            }
+        }
+        if ((char)key == ' '
+            && (m_game_state == GameState::BEFORE_START || m_game_state == GameState::FAILED)) {
+            m_game_state = GameState::FALLING;
+            reset();
+            return true;
+        }
+        return false;
+    }
+
+    // Advance the game by one frame
+    GameEvent step() {
+        GameEvent event = GameEvent::NONE;
+        if (m_game_state == GameState::FALLING) {
+            if (m_motion.get_falling_pos() < 0.0f) {
+                m_game_state = GameState::JUGGLING;
+                ++m_count;
+                m_motion.set_dest();
+                event = GameEvent::SCORED;
+            }
+            m_motion.update_fall();
+        } else if (m_game_state == GameState::JUGGLING) {
+            if (is_failure()) {
+                m_game_state = GameState::FAILED;
+                return GameEvent::FAILED;
+            }
+            if (m_motion.is_fallen()) {
+                ++m_count;
+                m_motion.set_dest();
+                event = GameEvent::SCORED;
+            }
+            m_motion.update_juggle();
+        }
+        return event;
+    }
+
+   private:
+    bool is_failure() const {
+        if (!m_motion.is_fallen()) {
+            return false;
+        }
+        if (m_motion.get_next_pos_idx() == m_tile_pos_idx) {
+            return false;
+        }
+        return true;
+    }
+
+    void reset() {
+        m_motion.reset();
+        m_tile_pos_idx = 4;
+        m_count        = 0;
+    }
+
+   private:
+    GameState m_game_state = GameState::BEFORE_START;
+    BallMotion m_motion;
+    int m_tile_pos_idx = 4;
+    int m_count        = 0;
+};
+
+// Splits index ranges over persistent threads. The calling thread works on the first range, so
+// one thread means no extra threads at all.
+class ParallelFor {
+   public:
+    ~ParallelFor() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_start_cv.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    void init(int num_threads) {
+        m_num_threads = std::max(1, num_threads);
+        for (int i = 1; i < m_num_threads; ++i) {
+            m_threads.emplace_back(&ParallelFor::worker_loop, this, i);
+        }
+    }
+
+    int get_num_threads() const {
+        return m_num_threads;
+    }
+
+    // Call func(thread, begin, end) on disjoint ranges covering [0, count), one per thread, and
+    // wait for all of them
+    void run(int count, const std::function<void(int, int, int)>& func) {
+        if (m_num_threads == 1) {
+            func(0, 0, count);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_func    = &func;
+            m_count   = count;
+            m_pending = m_num_threads - 1;
+            ++m_generation;
+        }
+        m_start_cv.notify_all();
+        func(0, 0, count / m_num_threads);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [this] { return m_pending == 0; });
+    }
+
+   private:
+    void worker_loop(int index) {
+        int generation = 0;
+        while (true) {
+            const std::function<void(int, int, int)>* func;
+            int count;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_start_cv.wait(lock, [&] { return m_stop || m_generation != generation; });
+                if (m_stop) {
+                    return;
+                }
+                generation = m_generation;
+                func       = m_func;
+                count      = m_count;
+            }
+
+            (*func)(index, (int)((long long)count * index / m_num_threads),
+                    (int)((long long)count * (index + 1) / m_num_threads));
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0) {
+                m_done_cv.notify_one();
+            }
+        }
+    }
+
+    int m_num_threads = 1;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start_cv;
+    std::condition_variable m_done_cv;
+    const std::function<void(int, int, int)>* m_func = nullptr;
+    int m_count                                      = 0;
+    int m_pending                                    = 0;
+    int m_generation                                 = 0;
+    bool m_stop                                      = false;
+};
+
+// Many balls under gravity on a field of cells_per_side^2 cells with walls around it. Balls
+// bounce off the floor, the walls and each other; landing on the player's tile kicks a ball back
+// up and scores. The state is kept as arrays of components.
+//
+// Each step integrates every ball, bins the balls into a spatial hash of cells one ball
+// diameter wide, then resolves contacts per ball against the balls of the 27 surrounding cells.
+// The hash keeps a copy of the positions in bucket order, so the narrowphase loads four
+// neighbors at once. A ball only writes its own result, so a contact pass runs on any number of
+// threads. One pass pushes each ball out of where its neighbors were before the pass, so a few
+// passes per step are needed for piles to hold their shape.
+class BallPhysics {
+   public:
+    void init(int num_balls, int cells_per_side, int num_threads, unsigned int seed) {
+        m_cells_per_side = cells_per_side;
+        m_half_extent    = (float)cells_per_side;  // cells are 2 units wide
+        m_tile_x         = cells_per_side / 2;
+        m_tile_z         = cells_per_side / 2;
+        m_parallel.init(num_threads);
+
+        for (std::vector<float>* component : {&m_px, &m_py, &m_pz, &m_vx, &m_vy, &m_vz}) {
+            component->assign(num_balls, 0.0f);
+        }
+        m_next_px = m_px;
+        m_next_py = m_py;
+        m_next_pz = m_pz;
+        m_next_vx = m_vx;
+        m_next_vy = m_vy;
+        m_next_vz = m_vz;
+
+        // Drop the balls from random points above the field
+        std::minstd_rand rng(seed);
+        std::uniform_real_distribution<float> across(-m_half_extent + RADIUS,
+                                                     m_half_extent - RADIUS);
+        std::uniform_real_distribution<float> height(2.0f, 2.0f + num_balls / 64.0f);
+        std::uniform_real_distribution<float> drift(-2.0f, 2.0f);
+        for (int i = 0; i < num_balls; ++i) {
+            m_px[i] = across(rng);
+            m_py[i] = height(rng);
+            m_pz[i] = across(rng);
+            m_vx[i] = drift(rng);
+            m_vz[i] = drift(rng);
+        }
+
+        int table_size = 1;
+        while (table_size < 2 * num_balls) {
+            table_size *= 2;
+        }
+        m_hash_mask = table_size - 1;
+        m_cell_start.assign(table_size + 1, 0);
+        m_ball_cell.assign(num_balls, 0);
+        m_sorted.assign(num_balls, 0);
+        m_buckets.assign(num_balls * 27, 0);
+        m_num_buckets.assign(num_balls, 0);
+        // Padded so that the last bucket can be read four balls at a time
+        for (std::vector<float>* component : {&m_sorted_px, &m_sorted_py, &m_sorted_pz}) {
+            component->assign(num_balls + 3, FAR_AWAY);
+        }
+        m_thread_contacts.assign(m_parallel.get_num_threads(), 0);
+    }
+
+    void step(float dt) {
+        const auto start = std::chrono::steady_clock::now();
+        integrate(dt);
+
+        // The balls are binned once per step; the later passes only see the pushes of the
+        // earlier ones through the sorted positions
+        for (int pass = 0; pass < CONTACT_PASSES; ++pass) {
+            const bool first = pass == 0;
+            if (first) {
+                build_hash();
+            } else {
+                refresh_sorted_positions();
+            }
+            std::fill(m_thread_contacts.begin(), m_thread_contacts.end(), 0);
+            m_parallel.run(get_size(), [this, first](int thread, int begin, int end) {
+                m_thread_contacts[thread] = collide(begin, end, first);
+            });
+            if (first) {
+                m_contacts = 0;
+                for (int contacts : m_thread_contacts) {
+                    m_contacts += contacts;
+                }
+            }
+            m_vx.swap(m_next_vx);
+            m_vy.swap(m_next_vy);
+            m_vz.swap(m_next_vz);
+            m_px.swap(m_next_px);
+            m_py.swap(m_next_py);
+            m_pz.swap(m_next_pz);
+        }
+
+        const std::chrono::duration<double, std::milli> elapsed
+            = std::chrono::steady_clock::now() - start;
+        m_step_ms = elapsed.count();
+    }
+
+    void move_tile(int dx, int dz) {
+        m_tile_x = glm::clamp(m_tile_x + dx, 0, m_cells_per_side - 1);
+        m_tile_z = glm::clamp(m_tile_z + dz, 0, m_cells_per_side - 1);
+    }
+
+    glm::vec3 get_tile_center() const {
+        return get_cell_pos(m_tile_x, m_tile_z, m_cells_per_side);
+    }
+
+    int get_size() const {
+        return (int)m_px.size();
+    }
+
+    glm::vec3 get_position(int i) const {
+        return glm::vec3(m_px[i], m_py[i], m_pz[i]);
+    }
+
+    int get_score() const {
+        return m_score;
+    }
+
+    // Touching pairs found in the last step, each counted from both balls
+    int get_contacts() const {
+        return m_contacts;
+    }
+
+    double get_step_ms() const {
+        return m_step_ms;
+    }
+
+    int get_num_threads() const {
+        return m_parallel.get_num_threads();
+    }
+
+   private:
+    static constexpr float GRAVITY           = 20.0f;  // units / s^2
+    static constexpr float BALL_RESTITUTION  = 0.9f;
+    static constexpr float FLOOR_RESTITUTION = 0.7f;
+    static constexpr float FLOOR_FRICTION    = 0.98f;  // horizontal speed kept per floor contact
+    static constexpr float KICK_SPEED        = 16.0f;  // upward speed after landing on the tile
+    static constexpr float CELL_SIZE         = 2.0f * RADIUS;
+    static constexpr float FAR_AWAY          = 1e9f;  // position of the padding balls
+    static constexpr int CONTACT_PASSES      = 4;
+
+    struct Response {
+        glm::vec3 push    = glm::vec3(0.0f);
+        glm::vec3 impulse = glm::vec3(0.0f);
+        int contacts      = 0;
+    };
+
+    // Gravity and the static geometry. The floor is the top of the tiles, so a resting ball has
+    // its center at y = 0 like the balls of the 3x3 game.
+    void integrate(float dt) {
+        const float wall     = m_half_extent - RADIUS;
+        const glm::vec3 tile = get_tile_center();
+        for (int i = 0; i < get_size(); ++i) {
+            m_vy[i] -= GRAVITY * dt;
+            m_px[i] += m_vx[i] * dt;
+            m_py[i] += m_vy[i] * dt;
+            m_pz[i] += m_vz[i] * dt;
+
+            if (m_py[i] < 0.0f) {
+                m_py[i] = 0.0f;
+                if (m_vy[i] < 0.0f) {
+                    const bool on_tile
+                        = std::abs(m_px[i] - tile.x) < 1.0f && std::abs(m_pz[i] - tile.z) < 1.0f;
+                    if (on_tile) {
+                        m_vy[i] = KICK_SPEED;
+                        ++m_score;
+                    } else {
+                        m_vy[i] = -m_vy[i] * FLOOR_RESTITUTION;
+                        m_vx[i] *= FLOOR_FRICTION;
+                        m_vz[i] *= FLOOR_FRICTION;
+                    }
+                }
+            }
+            bounce_wall(m_px[i], m_vx[i], wall);
+            bounce_wall(m_pz[i], m_vz[i], wall);
+        }
+    }
+
+    static void bounce_wall(float& pos, float& vel, float wall) {
+        if (pos < -wall) {
+            pos = -wall;
+            vel = std::abs(vel);
+        } else if (pos > wall) {
+            pos = wall;
+            vel = -std::abs(vel);
+        }
+    }
+
+    int hash_cell(int cx, int cy, int cz) const {
+        const unsigned int h = (unsigned int)cx * 73856093u ^ (unsigned int)cy * 19349663u
+                               ^ (unsigned int)cz * 83492791u;
+        return (int)(h & m_hash_mask);
+    }
+
+    int cell_coord(float pos) const {
+        return (int)std::floor(pos / CELL_SIZE);
+    }
+
+    // Counting sort of the balls by hash bucket: the balls of bucket b are
+    // m_sorted[m_cell_start[b] .. m_cell_start[b + 1])
+    void build_hash() {
+        std::fill(m_cell_start.begin(), m_cell_start.end(), 0);
+        for (int i = 0; i < get_size(); ++i) {
+            m_ball_cell[i] = hash_cell(cell_coord(m_px[i]), cell_coord(m_py[i]),
+                                       cell_coord(m_pz[i]));
+            ++m_cell_start[m_ball_cell[i] + 1];
+        }
+        for (size_t b = 1; b < m_cell_start.size(); ++b) {
+            m_cell_start[b] += m_cell_start[b - 1];
+        }
+        m_fill.assign(m_cell_start.begin(), m_cell_start.end() - 1);
+        for (int i = 0; i < get_size(); ++i) {
+            const int k    = m_fill[m_ball_cell[i]]++;
+            m_sorted[k]    = i;
+            m_sorted_px[k] = m_px[i];
+            m_sorted_py[k] = m_py[i];
+            m_sorted_pz[k] = m_pz[i];
+        }
+    }
+
+    // Copy the positions into the bucket order of the last build_hash()
+    void refresh_sorted_positions() {
+        for (int k = 0; k < get_size(); ++k) {
+            m_sorted_px[k] = m_px[m_sorted[k]];
+            m_sorted_py[k] = m_py[m_sorted[k]];
+            m_sorted_pz[k] = m_pz[m_sorted[k]];
+        }
+    }
+
+    // Resolve the contacts of balls [begin, end) into the m_next_* arrays. Balls bounce off each
+    // other in the first pass of a step; the later passes have no restitution and only stop the
+    // balls of a pile from sinking into each other. Returns the number of contacts.
+    int collide(int begin, int end, bool first) {
+        const float wall        = m_half_extent - RADIUS;
+        const float restitution = first ? BALL_RESTITUTION : 0.0f;
+        int contacts            = 0;
+        for (int i = begin; i < end; ++i) {
+            int* buckets = &m_buckets[i * 27];
+            if (first) {
+                m_num_buckets[i] = gather_buckets(i, buckets);
+            }
+            const Response response = narrowphase(i, buckets, m_num_buckets[i], restitution);
+
+            // Every contact removes the whole approaching velocity on its own, so the bounces of
+            // a ball in a pile are averaged to keep the pile from gaining energy. Averaging the
+            // later passes too would leave the pile sinking. Pushes must not move a ball through
+            // the floor or the walls.
+            const float weight = first ? 1.0f / std::max(1, response.contacts) : 1.0f;
+            m_next_px[i]       = glm::clamp(m_px[i] + response.push.x, -wall, wall);
+            m_next_py[i]       = std::max(0.0f, m_py[i] + response.push.y);
+            m_next_pz[i]       = glm::clamp(m_pz[i] + response.push.z, -wall, wall);
+            m_next_vx[i]       = m_vx[i] + response.impulse.x * weight;
+            m_next_vy[i]       = m_vy[i] + response.impulse.y * weight;
+            m_next_vz[i]       = m_vz[i] + response.impulse.z * weight;
+            contacts += response.contacts;
+        }
+        return contacts;
+    }
+
+    // Hash buckets of the 27 cells around ball i. Distinct cells may share a bucket, so each
+    // bucket is listed once.
+    int gather_buckets(int i, int* buckets) const {
+        const int cx    = cell_coord(m_px[i]);
+        const int cy    = cell_coord(m_py[i]);
+        const int cz    = cell_coord(m_pz[i]);
+        int num_buckets = 0;
+        for (int dz = -1; dz <= 1; ++dz) {
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    const int bucket = hash_cell(cx + dx, cy + dy, cz + dz);
+                    if (std::find(buckets, buckets + num_buckets, bucket)
+                        == buckets + num_buckets) {
+                        buckets[num_buckets++] = bucket;
+                    }
+                }
+            }
+        }
+        return num_buckets;
+    }
+
+    // Test ball i against the balls of the buckets and sum the response of every touching pair
+    Response narrowphase(int i, const int* buckets, int num_buckets, float restitution) const {
+        const float contact_dist2 = 4.0f * RADIUS * RADIUS;
+        Response response;
+#ifdef USE_SSE
+        const __m128 xi = _mm_set1_ps(m_px[i]);
+        const __m128 yi = _mm_set1_ps(m_py[i]);
+        const __m128 zi = _mm_set1_ps(m_pz[i]);
+        const __m128 r2 = _mm_set1_ps(contact_dist2);
+        for (int b = 0; b < num_buckets; ++b) {
+            const int end = m_cell_start[buckets[b] + 1];
+            for (int k = m_cell_start[buckets[b]]; k < end; k += 4) {
+                const __m128 dx = _mm_sub_ps(xi, _mm_loadu_ps(&m_sorted_px[k]));
+                const __m128 dy = _mm_sub_ps(yi, _mm_loadu_ps(&m_sorted_py[k]));
+                const __m128 dz = _mm_sub_ps(zi, _mm_loadu_ps(&m_sorted_pz[k]));
+                const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                             _mm_mul_ps(dz, dz));
+                // Lanes past the end of the bucket hold the balls of the next one
+                const int valid = end - k < 4 ? (1 << (end - k)) - 1 : 0xf;
+                int mask        = _mm_movemask_ps(_mm_cmplt_ps(d2, r2)) & valid;
+                for (int lane = 0; mask != 0; ++lane, mask >>= 1) {
+                    if (mask & 1) {
+                        add_contact(i, m_sorted[k + lane], restitution, response);
+                    }
+                }
+            }
+        }
+#else
+        for (int b = 0; b < num_buckets; ++b) {
+            for (int k = m_cell_start[buckets[b]]; k < m_cell_start[buckets[b] + 1]; ++k) {
+                const float dx = m_px[i] - m_sorted_px[k];
+                const float dy = m_py[i] - m_sorted_py[k];
+                const float dz = m_pz[i] - m_sorted_pz[k];
+                if (dx * dx + dy * dy + dz * dz < contact_dist2) {
+                    add_contact(i, m_sorted[k], restitution, response);
+                }
+            }
+        }
+#endif
+        return response;
+    }
+
+    // Push ball i out of ball j by half the overlap and remove half of the approaching velocity,
+    // scaled by the restitution. Ball j does the mirror image when it is resolved.
+    void add_contact(int i, int j, float restitution, Response& response) const {
+        if (i == j) {
+            return;
+        }
+        glm::vec3 normal    = get_position(i) - get_position(j);
+        const float dist    = glm::length(normal);
+        // Coincident balls are split along x, in opposite directions for i and j
+        normal              = dist > 1e-6f ? normal / dist : glm::vec3(i < j ? 1.0f : -1.0f, 0, 0);
+        const float overlap = 2.0f * RADIUS - dist;
+        response.push += normal * (overlap * 0.5f);
+        response.contacts++;
+
+        const glm::vec3 relative_vel(m_vx[i] - m_vx[j], m_vy[i] - m_vy[j], m_vz[i] - m_vz[j]);
+        const float approach = glm::dot(relative_vel, normal);
+        if (approach < 0.0f) {
+            response.impulse += normal * (-(1.0f + restitution) * 0.5f * approach);
+        }
+    }
+
+   private:
+    int m_cells_per_side     = 0;
+    float m_half_extent      = 0.0f;
+    unsigned int m_hash_mask = 0;
+    int m_tile_x             = 0;
+    int m_tile_z             = 0;
+    int m_score              = 0;
+    int m_contacts           = 0;
+    double m_step_ms         = 0.0;
+
+    std::vector<float> m_px, m_py, m_pz, m_vx, m_vy, m_vz;
+    std::vector<float> m_next_px, m_next_py, m_next_pz, m_next_vx, m_next_vy, m_next_vz;
+
+    std::vector<int> m_cell_start;  // one past the last bucket holds the ball count
+    std::vector<int> m_ball_cell;
+    std::vector<int> m_sorted;
+    std::vector<float> m_sorted_px, m_sorted_py, m_sorted_pz;  // positions in m_sorted order
+    std::vector<int> m_fill;
+    std::vector<int> m_buckets;  // the hash buckets around each ball, 27 per ball
+    std::vector<int> m_num_buckets;
+    std::vector<int> m_thread_contacts;
+
+    ParallelFor m_parallel;
+};
+
+constexpr float BallPhysics::FAR_AWAY;
+
+using Entity = uint32_t;
+
+// Components of one type packed densely, with the entity of each slot alongside. Removing a
+// component moves the last one into its slot, so systems can always iterate the slots linearly
+// and look up the other components of the entity.
+template <typename T>
+class ComponentArray {
+   public:
+    T& add(Entity entity, const T& component) {
+        if (entity >= m_slots.size()) {
+            m_slots.resize(entity + 1, NO_SLOT);
+        }
+        if (m_slots[entity] == NO_SLOT) {
+            m_slots[entity] = (int)m_components.size();
+            m_components.push_back(component);
+            m_entities.push_back(entity);
+        } else {
+            m_components[m_slots[entity]] = component;
+        }
+        return m_components[m_slots[entity]];
+    }
+
+    void remove(Entity entity) {
+        if (!has(entity)) {
+            return;
+        }
+        const int slot     = m_slots[entity];
+        const Entity moved = m_entities.back();
+        m_components[slot] = m_components.back();
+        m_entities[slot]   = moved;
+        m_slots[moved]     = slot;
+        m_slots[entity]    = NO_SLOT;
+        m_components.pop_back();
+        m_entities.pop_back();
+    }
+
+    bool has(Entity entity) const {
+        return entity < m_slots.size() && m_slots[entity] != NO_SLOT;
+    }
+
+    T& get(Entity entity) {
+        return m_components[m_slots[entity]];
+    }
+
+    const T& get(Entity entity) const {
+        return m_components[m_slots[entity]];
+    }
+
+    int get_size() const {
+        return (int)m_components.size();
+    }
+
+    T& at(int slot) {
+        return m_components[slot];
+    }
+
+    const T& at(int slot) const {
+        return m_components[slot];
+    }
+
+    Entity get_entity(int slot) const {
+        return m_entities[slot];
+    }
+
+   private:
+    static constexpr int NO_SLOT = -1;
+
+    std::vector<T> m_components;
+    std::vector<Entity> m_entities;
+    std::vector<int> m_slots;  // indexed by entity
+};
+
+template <typename T>
+constexpr int ComponentArray<T>::NO_SLOT;
+
+struct Transform {
+    glm::mat4 model_mat = glm::mat4(1.0f);
+};
+
+// Layers are drawn in this order, and the entities of a layer front to back, so that the large
+// surfaces at the bottom of the scene are depth-tested against what stands on them. The grid
+// comes before the tiles because its lines lie in the same plane.
+enum class Layer {
+    OBJECTS,
+    GRID,
+    TILES,
+    GROUND,
+};
+
+// Indices of the Mesh and Material in the Scene
+struct Renderable {
+    int mesh     = 0;
+    int material = 0;
+    Layer layer  = Layer::OBJECTS;
+    bool visible = true;
+};
+
+// World-space bounding sphere, updated from the Transform every frame
+struct Bounds {
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius     = 0.0f;
+};
+
+// Ball simulated by BallPhysics. The simulation has no spin, so the orientation stays fixed.
+struct PhysicsBody {
+    int index             = 0;
+    glm::mat3 orientation = glm::mat3(1.0f);
+};
+
+// Entities, their components and the meshes and materials they refer to. The systems below only
+// walk the component arrays, so adding objects to the scene needs no new code.
+class Scene {
+   public:
+    int add_mesh(Mesh mesh) {
+        m_meshes.push_back(std::move(mesh));
+        return (int)m_meshes.size() - 1;
+    }
+
+    int add_material(Material material) {
+        m_materials.push_back(std::move(material));
+        return (int)m_materials.size() - 1;
+    }
+
+    const Mesh& get_mesh(int mesh) const {
+        return m_meshes[mesh];
+    }
+
+    const Material& get_material(int material) const {
+        return m_materials[material];
+    }
+
+    Entity create_entity() {
+        if (!m_free_entities.empty()) {
+            const Entity entity = m_free_entities.back();
+            m_free_entities.pop_back();
+            return entity;
+        }
+        return m_next_entity++;
+    }
+
+    // Entity with the components needed to be drawn
+    Entity create_drawable(int mesh, int material, Layer layer = Layer::OBJECTS,
+                           const glm::mat4& model_mat = glm::mat4(1.0f)) {
+        const Entity entity = create_entity();
+        m_transforms.add(entity, Transform{model_mat});
+        m_renderables.add(entity, Renderable{mesh, material, layer, true});
+        m_bounds.add(entity, Bounds());
+        return entity;
+    }
+
+    void destroy_entity(Entity entity) {
+        m_transforms.remove(entity);
+        m_renderables.remove(entity);
+        m_bounds.remove(entity);
+        m_bodies.remove(entity);
+        m_free_entities.push_back(entity);
+    }
+
+    int get_num_entities() const {
+        return (int)(m_next_entity - m_free_entities.size());
+    }
+
+    ComponentArray<Transform>& get_transforms() {
+        return m_transforms;
+    }
+
+    const ComponentArray<Transform>& get_transforms() const {
+        return m_transforms;
+    }
+
+    ComponentArray<Renderable>& get_renderables() {
+        return m_renderables;
+    }
+
+    const ComponentArray<Renderable>& get_renderables() const {
+        return m_renderables;
+    }
+
+    const ComponentArray<Bounds>& get_bounds() const {
+        return m_bounds;
+    }
+
+    ComponentArray<PhysicsBody>& get_bodies() {
+        return m_bodies;
+    }
+
+    // Place the entities of the simulated balls
+    void sync_bodies(const BallPhysics& physics) {
+        for (int i = 0; i < m_bodies.get_size(); ++i) {
+            const PhysicsBody& body = m_bodies.at(i);
+            m_transforms.get(m_bodies.get_entity(i)).model_mat
+                = glm::translate(glm::mat4(1.0f), physics.get_position(body.index))
+                  * glm::mat4(body.orientation);
+        }
+    }
+
+    void update_bounds() {
+        for (int i = 0; i < m_bounds.get_size(); ++i) {
+            const Entity entity       = m_bounds.get_entity(i);
+            const Mesh& mesh          = m_meshes[m_renderables.get(entity).mesh];
+            const glm::mat4 model_mat = m_transforms.get(entity).model_mat * mesh.adj_mat;
+            const float scale         = std::max({glm::length(glm::vec3(model_mat[0])),
+                                                  glm::length(glm::vec3(model_mat[1])),
+                                                  glm::length(glm::vec3(model_mat[2]))});
+
+            Bounds& bounds = m_bounds.at(i);
+            bounds.center  = glm::vec3(model_mat * glm::vec4(mesh.center, 1.0f));
+            bounds.radius  = mesh.radius * scale;
+        }
+    }
+
+   private:
+    std::vector<Mesh> m_meshes;
+    std::vector<Material> m_materials;
+
+    ComponentArray<Transform> m_transforms;
+    ComponentArray<Renderable> m_renderables;
+    ComponentArray<Bounds> m_bounds;
+    ComponentArray<PhysicsBody> m_bodies;
+
+    Entity m_next_entity = 0;
+    std::vector<Entity> m_free_entities;
+};
+
+// Draws the visible entities of a Scene. Entities outside the view frustum are culled and the
+// rest are sorted by layer and front to back, which lets the depth test reject hidden fragments
+// before they are shaded; software rasterizers are bound by fill rate. Without
+// g_sort_front_to_back they are sorted by material and mesh only. Consecutive draws of the same
+// material and mesh share their GL state, and impostors share batches.
+class SceneRenderer {
+   public:
+    void draw(Scene& scene) {
+        scene.update_bounds();
+        build_draw_list(scene);
+
+        size_t first = 0;
+        while (first < m_draw_list.size()) {
+            size_t last = first + 1;
+            while (last < m_draw_list.size() && m_draw_list[last].key == m_draw_list[first].key) {
+                ++last;
+            }
+
+            const Renderable& renderable = scene.get_renderables().get(m_draw_list[first].entity);
+            const Material& material     = scene.get_material(renderable.material);
+            const Mesh& mesh             = scene.get_mesh(renderable.mesh);
+            g_gl_state.use_program(material.program.get());
+            g_gl_state.bind_vertex_array(mesh.vao.get());
+            if (material.texture.get() != 0) {
+                g_gl_state.bind_texture(0, material.texture_target, material.texture.get());
+            }
+            if (material.shading == Shading::IMPOSTOR) {
+                draw_impostors(scene, mesh, first, last);
+            } else {
+                for (size_t i = first; i < last; ++i) {
+                    const Transform& transform
+                        = scene.get_transforms().get(m_draw_list[i].entity);
+                    draw_mesh(material.shading, mesh, transform.model_mat * mesh.adj_mat);
+                }
+            }
+            first = last;
+        }
+    }
+
+    int get_num_visible() const {
+        return (int)m_draw_list.size();
+    }
+
+   private:
+    struct DrawItem {
+        int layer;
+        float depth;   // view-space distance of the bounds center
+        uint32_t key;  // material in the high half, mesh in the low half
+        Entity entity;
+    };
+
+    void build_draw_list(const Scene& scene) {
+        glm::vec4 planes[6];
+        calc_frustum_planes(g_proj_mat * g_view_mat, planes);
+
+        m_draw_list.clear();
+        const ComponentArray<Bounds>& bounds = scene.get_bounds();
+        for (int i = 0; i < bounds.get_size(); ++i) {
+            const Entity entity          = bounds.get_entity(i);
+            const Renderable& renderable = scene.get_renderables().get(entity);
+            if (!renderable.visible || !intersects(planes, bounds.at(i))) {
+                continue;
+            }
+            DrawItem item;
+            item.layer  = 0;
+            item.depth  = 0.0f;
+            item.key    = (uint32_t)renderable.material << 16 | (uint32_t)renderable.mesh;
+            item.entity = entity;
+            if (g_sort_front_to_back) {
+                item.layer = (int)renderable.layer;
+                item.depth = -(g_view_mat * glm::vec4(bounds.at(i).center, 1.0f)).z;
+            }
+            m_draw_list.push_back(item);
+        }
+        // Ties are drawn in creation order, which keeps the frame deterministic
+        std::sort(m_draw_list.begin(), m_draw_list.end(), [](const DrawItem& a, const DrawItem& b) {
+            if (a.layer != b.layer) {
+                return a.layer < b.layer;
+            }
+            if (a.depth != b.depth) {
+                return a.depth < b.depth;
+            }
+            return a.key != b.key ? a.key < b.key : a.entity < b.entity;
+        });
+    }
+
+    static void draw_mesh(Shading shading, const Mesh& mesh, const glm::mat4& model_mat) {
+        const glm::mat4 mv_mat  = g_view_mat * model_mat;
+        const glm::mat4 mvp_mat = g_proj_mat * mv_mat;
+        if (shading == Shading::LIT) {
+            DrawConstants3 constants;
+            constants.mv_mat     = mv_mat;
+            constants.mvp_mat    = mvp_mat;
+            constants.norm_mat   = glm::transpose(glm::inverse(mv_mat));
+            constants.light_mat  = g_view_mat;
+            constants.light_pos  = glm::vec4(LIGHT_POS, 1.0f);
+            constants.spec_color = glm::vec4(SPEC_COLOR, 0.0f);
+            constants.ambi_color = glm::vec4(AMBI_COLOR, 0.0f);
+            constants.shininess  = SHININESS;
+            bind_draw_constants(&constants, sizeof(constants));
+        } else {
+            DrawConstants1 constants;
+            constants.mvp_mat = mvp_mat;
+            bind_draw_constants(&constants, sizeof(constants));
+        }
+        g_gl_state.draw_elements(mesh.mode, mesh.num_indices);
+    }
+
+    // Draw the spheres as screen-aligned quads, ray-traced in the fragment shader
+    void draw_impostors(const Scene& scene, const Mesh& mesh, size_t first, size_t last) {
+        ImpostorConstants constants;
+        constants.proj_mat   = g_proj_mat;
+        constants.light_pos  = g_view_mat * glm::vec4(LIGHT_POS, 1.0f);
+        constants.spec_color = glm::vec4(SPEC_COLOR, 0.0f);
+        constants.ambi_color = glm::vec4(AMBI_COLOR, 0.0f);
+        constants.shininess  = SHININESS;
+
+        while (first < last) {
+            const int batch = (int)std::min((size_t)IMPOSTOR_BATCH_SIZE, last - first);
+            for (int i = 0; i < batch; ++i) {
+                const Transform& transform
+                    = scene.get_transforms().get(m_draw_list[first + i].entity);
+                constants.spheres[i] = calc_sphere_instance(mesh, transform.model_mat);
+            }
+            // The shader only reads the spheres of its instances
+            const size_t used_size
+                = offsetof(ImpostorConstants, spheres) + sizeof(SphereInstance) * batch;
+            bind_draw_constants(&constants, sizeof(constants), used_size);
+            g_gl_state.draw_elements_instanced(mesh.mode, mesh.num_indices, batch);
+            first += batch;
+        }
+    }
+
+    static SphereInstance calc_sphere_instance(const Mesh& mesh, const glm::mat4& model_mat) {
+        const glm::mat4 mv_mat = g_view_mat * model_mat * mesh.adj_mat;
+        // The rotation is orthogonal up to the uniform scale, so its inverse is the transpose
+        const float scale          = glm::length(glm::vec3(mv_mat[0]));
+        const glm::mat3 to_pattern = glm::transpose(glm::mat3(mv_mat)) / scale;
+
+        SphereInstance sphere;
+        sphere.center_radius
+            = glm::vec4(glm::vec3(mv_mat * glm::vec4(mesh.center, 1.0f)), mesh.radius * scale);
+        sphere.axis_x = glm::vec4(to_pattern[0], 0.0f);
+        sphere.axis_y = glm::vec4(to_pattern[1], 0.0f);
+        sphere.axis_z = glm::vec4(to_pattern[2], 0.0f);
+        return sphere;
+    }
+
+    // Planes of the frustum of view_proj_mat with their normals pointing inwards
+    static void calc_frustum_planes(const glm::mat4& view_proj_mat, glm::vec4 planes[6]) {
+        const glm::mat4 rows = glm::transpose(view_proj_mat);
+        for (int i = 0; i < 3; ++i) {
+            planes[2 * i]     = rows[3] + rows[i];
+            planes[2 * i + 1] = rows[3] - rows[i];
+        }
+        for (int i = 0; i < 6; ++i) {
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+        }
+    }
+
+    static bool intersects(const glm::vec4 planes[6], const Bounds& bounds) {
+        for (int i = 0; i < 6; ++i) {
+            if (glm::dot(glm::vec3(planes[i]), bounds.center) + planes[i].w < -bounds.radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+   private:
+    std::vector<DrawItem> m_draw_list;
+};
+
+class FrameStats {
+   public:
+    static constexpr int HISTORY_SIZE = 128;
+
+    // interval: time since the previous frame, frame_time: time spent rendering this frame
+    void add_frame(double interval, double frame_time) {
+        m_frame_times[m_next] = (float)(frame_time * 1000.0);
+        m_next                = (m_next + 1) % HISTORY_SIZE;
+        m_size                = std::min(m_size + 1, HISTORY_SIZE);
+
+        const double fps = interval > 0.0 ? 1.0 / interval : 0.0;
+        m_fps            = m_fps == 0.0 ? fps : m_fps * 0.95 + fps * 0.05;
+        m_frame_time_ms  = frame_time * 1000.0;
+    }
+
+    double get_fps() const {
+        return m_fps;
+    }
+
+    double get_frame_time_ms() const {
+        return m_frame_time_ms;
+    }
+
+    int get_size() const {
+        return m_size;
+    }
+
+    // i = 0 is the oldest frame in the history
+    float get_frame_time_ms(int i) const {
+        return m_frame_times[(m_next - m_size + i + HISTORY_SIZE) % HISTORY_SIZE];
+    }
+
+   private:
+    float m_frame_times[HISTORY_SIZE] = {};
+    int m_next                        = 0;
+    int m_size                        = 0;
+    double m_fps                      = 0.0;
+    double m_frame_time_ms            = 0.0;
+};
+
+// Before C++17, a static constexpr member that is odr-used, for example by std::min taking it by
+// reference, also needs a definition outside its class
+constexpr int FrameStats::HISTORY_SIZE;
+
+// Screen-space text and graphs. All quads of a frame are written straight into the stream buffer
+// and drawn with a single call.
+class Hud {
+   public:
+    void init() {
+        init_font_atlas();
+        init_quad_buffer();
+        m_program             = build_shader_program(HUD_VERT_SHADER_FILE, HUD_FRAG_SHADER_FILE);
+        m_screen_size_location = glGetUniformLocation(m_program.get(), "u_screen_size");
+    }
+
+    void begin() {
+        m_vertices = (Vertex4*)g_stream_buffer.reserve(sizeof(Vertex4) * 4 * HUD_MAX_QUADS,
+                                                       sizeof(Vertex4));
+        m_num_quads = 0;
+    }
+
+    void add_rect(float x, float y, float w, float h, const glm::vec4& color) {
+        const int cx = HUD_SOLID_GLYPH % HUD_ATLAS_COLUMNS;
+        const int cy = HUD_SOLID_GLYPH / HUD_ATLAS_COLUMNS;
+        add_quad(x, y, w, h, cx * HUD_GLYPH_CELL + 1, cy * HUD_GLYPH_CELL + 1, 1, 1, color);
+    }
+
+    // (x, y) is the top left corner in framebuffer pixels
+    void add_text(float x, float y, float scale, const glm::vec4& color, const char* text) {
+        const float start_x = x;
+        for (const char* c = text; *c != '\0'; ++c) {
+            if (*c == '\n') {
+                x = start_x;
+                y += (HUD_GLYPH_CELL + 2) * scale;
+                continue;
+            }
+            const int code = std::toupper((unsigned char)*c);
+            if (code > ' ' && code < ' ' + 64) {
+                const int cx = code % HUD_ATLAS_COLUMNS;
+                const int cy = code / HUD_ATLAS_COLUMNS;
+                add_quad(x, y, HUD_GLYPH_WIDTH * scale, HUD_GLYPH_HEIGHT * scale,
+                         cx * HUD_GLYPH_CELL, cy * HUD_GLYPH_CELL, HUD_GLYPH_WIDTH,
+                         HUD_GLYPH_HEIGHT, color);
+            }
+            x += (HUD_GLYPH_WIDTH + 1) * scale;
+        }
+    }
+
+    static float text_width(float scale, const char* text) {
+        return std::strlen(text) * (HUD_GLYPH_WIDTH + 1) * scale;
+    }
+
+    void draw(int width, int height) {
+        const GLintptr offset = g_stream_buffer.commit(sizeof(Vertex4) * 4 * m_num_quads);
+        if (m_num_quads == 0) {
+            return;
+        }
+
+        g_gl_state.set_enabled(GL_DEPTH_TEST, false);
+        g_gl_state.set_enabled(GL_BLEND, true);
+        g_gl_state.set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        if (m_stream_generation != g_stream_buffer.get_generation()) {
+            init_vertex_array();
+        }
+        g_gl_state.use_program(m_program.get());
+        g_gl_state.bind_vertex_array(m_vao.get());
+        g_gl_state.bind_texture(0, GL_TEXTURE_2D, m_texture.get());
+        glUniform2f(m_screen_size_location, (float)width, (float)height);
+        g_gl_state.count_calls(1);
+        g_gl_state.draw_elements(GL_TRIANGLES, 6 * m_num_quads,
+                                 (GLint)(offset / sizeof(Vertex4)));
+
+        g_gl_state.set_enabled(GL_BLEND, false);
+        g_gl_state.set_enabled(GL_DEPTH_TEST, true);
+    }
+
+   private:
+    void add_quad(float x, float y, float w, float h, int tx, int ty, int tw, int th,
+                  const glm::vec4& color) {
+        if (m_num_quads >= HUD_MAX_QUADS) {
+            return;
+        }
+        const glm::vec2 atlas_size(HUD_ATLAS_COLUMNS * HUD_GLYPH_CELL,
+                                   HUD_ATLAS_ROWS * HUD_GLYPH_CELL);
+        const glm::vec2 uv0 = glm::vec2(tx, ty) / atlas_size;
+        const glm::vec2 uv1 = glm::vec2(tx + tw, ty + th) / atlas_size;
+
+        Vertex4* v = m_vertices + 4 * m_num_quads;
+        v[0]       = Vertex4(glm::vec2(x, y), uv0, color);
+        v[1]       = Vertex4(glm::vec2(x, y + h), glm::vec2(uv0.x, uv1.y), color);
+        v[2]       = Vertex4(glm::vec2(x + w, y + h), uv1, color);
+        v[3]       = Vertex4(glm::vec2(x + w, y), glm::vec2(uv1.x, uv0.y), color);
+        m_num_quads++;
+    }
+
+    // Pre-rasterize HUD_FONT into white glyphs with coverage in alpha
+    void init_font_atlas() {
+        const int atlas_width  = HUD_ATLAS_COLUMNS * HUD_GLYPH_CELL;
+        const int atlas_height = HUD_ATLAS_ROWS * HUD_GLYPH_CELL;
+        std::vector<unsigned char> pixels(atlas_width * atlas_height * 4, 0);
+        auto set_pixel = [&](int x, int y) {
+            unsigned char* p = &pixels[(y * atlas_width + x) * 4];
+            p[0] = p[1] = p[2] = p[3] = 255;
+        };
+
+        for (int code = ' '; code < ' ' + 64; ++code) {
+            const int x0 = (code % HUD_ATLAS_COLUMNS) * HUD_GLYPH_CELL;
+            const int y0 = (code / HUD_ATLAS_COLUMNS) * HUD_GLYPH_CELL;
+            for (int y = 0; y < HUD_GLYPH_HEIGHT; ++y) {
+                for (int x = 0; x < HUD_GLYPH_WIDTH; ++x) {
+                    if (HUD_FONT[code - ' '][y] & (1 << (HUD_GLYPH_WIDTH - 1 - x))) {
+                        set_pixel(x0 + x, y0 + y);
+                    }
+                }
+            }
+        }
+        const int x0 = (HUD_SOLID_GLYPH % HUD_ATLAS_COLUMNS) * HUD_GLYPH_CELL;
+        const int y0 = (HUD_SOLID_GLYPH / HUD_ATLAS_COLUMNS) * HUD_GLYPH_CELL;
+        for (int y = 0; y < HUD_GLYPH_CELL; ++y) {
+            for (int x = 0; x < HUD_GLYPH_CELL; ++x) {
+                set_pixel(x0 + x, y0 + y);
+            }
+        }
+
+        m_texture = create_texture(pixels.data(), atlas_width, atlas_height, GL_NEAREST,
+                                   GL_CLAMP_TO_EDGE);
+    }
+
+    void init_quad_buffer() {
+        std::vector<unsigned int> indices;
+        for (unsigned int i = 0; i < HUD_MAX_QUADS; ++i) {
+            const unsigned int quad[6] = {0, 1, 2, 2, 3, 0};
+            for (int k = 0; k < 6; ++k) {
+                indices.push_back(4 * i + quad[k]);
+            }
+        }
+
+        m_ibo = create_index_buffer(indices);
+        init_vertex_array();
+    }
+
+    // Quads are addressed with a base vertex into the stream buffer
+    void init_vertex_array() {
+        const VertexAttrib attribs[] = {
+            {0, 2, offsetof(Vertex4, position)},
+            {1, 2, offsetof(Vertex4, texcoord)},
+            {2, 4, offsetof(Vertex4, color)},
+        };
+        m_vao = create_vertex_array(g_stream_buffer.get_id(), m_ibo.get(), sizeof(Vertex4), attribs,
+                                    3);
+        m_stream_generation = g_stream_buffer.get_generation();
+    }
+
+   private:
+    GLHandle m_vao;
+    GLHandle m_ibo;
+    GLHandle m_texture;
+    GLHandle m_program;
+    GLint m_screen_size_location = -1;
+    int m_stream_generation      = 0;
+
+    Vertex4* m_vertices = nullptr;
+    int m_num_quads     = 0;
+};
+
+// Counts the fragments that pass the depth test at each pixel in the stencil buffer, which is the
+// number of times the pixel is shaded when the depth test runs before the fragment shader. The
+// counts are read back and averaged, and replace the scene with a heat map.
+class OverdrawMeter {
+   public:
+    void begin() {
+        g_gl_state.set_enabled(GL_STENCIL_TEST, true);
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+        g_gl_state.count_calls(2);
+    }
+
+    // width and height are the size of the bound target; the readback stalls until the GPU is done
+    void end(Hud& hud, int width, int height) {
+        m_counts.resize((size_t)width * height);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, m_counts.data());
+        g_gl_state.count_calls(2);
+
+        long long fragments = 0;
+        int covered         = 0;
+        for (unsigned char count : m_counts) {
+            fragments += count;
+            covered += count > 0 ? 1 : 0;
+        }
+        m_average         = (double)fragments / m_counts.size();
+        m_covered_average = covered > 0 ? (double)fragments / covered : 0.0;
+        m_total += m_average;
+        m_frames++;
+        if (g_verbose && m_frames % (int)FPS == 0) {
+            printf("Overdraw: %.2f fragments per pixel, %.2f per covered pixel\n", m_average,
+                   m_covered_average);
+        }
+
+        // Paint every pixel with the color of its count; the highest color takes the rest
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        g_gl_state.count_calls(1);
+        const int num_colors = (int)(sizeof(OVERDRAW_COLORS) / sizeof(OVERDRAW_COLORS[0]));
+        for (int i = 0; i < num_colors; ++i) {
+            glStencilFunc(i + 1 < num_colors ? GL_EQUAL : GL_LEQUAL, i + 1, 0xFF);
+            g_gl_state.count_calls(1);
+            hud.begin();
+            hud.add_rect(0.0f, 0.0f, (float)width, (float)height, OVERDRAW_COLORS[i]);
+            hud.draw(width, height);
+        }
+        g_gl_state.set_enabled(GL_STENCIL_TEST, false);
+    }
+
+    double get_average() const {
+        return m_average;
+    }
+
+    // Mean of the per-frame averages since the start
+    double get_mean_average() const {
+        return m_frames > 0 ? m_total / m_frames : 0.0;
+    }
+
+   private:
+    std::vector<unsigned char> m_counts;
+    double m_average         = 0.0;
+    double m_covered_average = 0.0;
+    double m_total           = 0.0;
+    int m_frames             = 0;
+};
+
+// Renders the scene into an offscreen target at a fraction of the framebuffer size and upscales
+// it to the window. The fraction follows the measured render time against the 1 / FPS budget.
+class DynamicResolution {
+   public:
+    void init(float min_scale, float max_scale) {
+        m_min_scale = min_scale;
+        m_max_scale = max_scale;
+        m_scale     = max_scale;
+    }
+
+    void begin_scene(int fb_width, int fb_height) {
+        if (fb_width != m_fb_width || fb_height != m_fb_height) {
+            resize(fb_width, fb_height);
+        }
+        m_scene_width  = std::max(1, (int)(fb_width * m_scale));
+        m_scene_height = std::max(1, (int)(fb_height * m_scale));
+        g_gl_state.bind_framebuffer(m_fbo.get());
+        glViewport(0, 0, m_scene_width, m_scene_height);
+        g_gl_state.count_calls(1);
+    }
+
+    void end_scene() {
+        if (g_gl_state.has_dsa()) {
+            glBlitNamedFramebuffer(m_fbo.get(), 0, 0, 0, m_scene_width, m_scene_height, 0, 0,
+                                   m_fb_width, m_fb_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        } else {
+            g_gl_state.bind_framebuffer(0);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo.get());
+            glBlitFramebuffer(0, 0, m_scene_width, m_scene_height, 0, 0, m_fb_width, m_fb_height,
+                              GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            // g_gl_state tracks GL_FRAMEBUFFER, i.e. both targets, and already holds 0
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            g_gl_state.count_calls(2);
+        }
+        g_gl_state.bind_framebuffer(0);
+        glViewport(0, 0, m_fb_width, m_fb_height);
+        g_gl_state.count_calls(2);
+    }
+
+    // render_time: CPU or GPU time of a recent frame, whichever is longer, excluding the wait
+    // for vsync
+    void update(double render_time) {
+        m_avg_time = m_avg_time == 0.0 ? render_time : m_avg_time * 0.9 + render_time * 0.1;
+        if (++m_frames_since_change < SCALE_COOLDOWN_FRAMES) {
+            return;
+        }
+
+        // Fill cost is proportional to the number of pixels, i.e. to the square of the scale
+        const double budget = 1.0 / FPS;
+        float next_scale    = m_scale;
+        if (m_avg_time > budget * 0.9) {
+            next_scale = m_scale * (float)std::sqrt(budget * 0.8 / m_avg_time);
+        } else if (m_avg_time < budget * 0.6) {
+            next_scale = m_scale + SCALE_STEP;
+        }
+        next_scale = glm::clamp(next_scale, m_min_scale, m_max_scale);
+        if (std::abs(next_scale - m_scale) >= SCALE_STEP * 0.5f) {
+            m_scale               = next_scale;
+            m_frames_since_change = 0;
+        }
+    }
+
+    void release() {
+        m_fbo.reset();
+        m_color.reset();
+        m_depth.reset();
+        m_fb_width  = 0;
+        m_fb_height = 0;
+    }
+
+    float get_scale() const {
+        return m_scale;
+    }
+
+    int get_scene_width() const {
+        return m_scene_width;
+    }
+
+    int get_scene_height() const {
+        return m_scene_height;
+    }
+
+   private:
+    static constexpr int SCALE_COOLDOWN_FRAMES = 15;
+    static constexpr float SCALE_STEP          = 0.05f;
+
+    // The target is allocated for the maximum scale, lower scales render into a corner of it
+    void resize(int fb_width, int fb_height) {
+        m_fb_width             = fb_width;
+        m_fb_height            = fb_height;
+        const int tex_width    = std::max(1, (int)std::ceil(fb_width * m_max_scale));
+        const int tex_height   = std::max(1, (int)std::ceil(fb_height * m_max_scale));
+        const long long pixels = (long long)tex_width * tex_height;
+
+        // Assigning the handles deletes the previous target
+        m_fbo   = GLHandle::create(GLObjectType::FRAMEBUFFER, GpuCategory::FRAMEBUFFER, 0);
+        m_color = GLHandle::create(GLObjectType::TEXTURE, GpuCategory::RENDER_TARGET, pixels * 4,
+                                   GL_TEXTURE_2D);
+        m_depth = GLHandle::create(GLObjectType::RENDERBUFFER, GpuCategory::RENDER_TARGET,
+                                   pixels * 4);
+
+        GLenum status;
+        if (g_gl_state.has_dsa()) {
+            glTextureStorage2D(m_color.get(), 1, GL_RGBA8, tex_width, tex_height);
+            glNamedRenderbufferStorage(m_depth.get(), GL_DEPTH24_STENCIL8, tex_width, tex_height);
+            glNamedFramebufferTexture(m_fbo.get(), GL_COLOR_ATTACHMENT0, m_color.get(), 0);
+            glNamedFramebufferRenderbuffer(m_fbo.get(), GL_DEPTH_STENCIL_ATTACHMENT,
+                                           GL_RENDERBUFFER, m_depth.get());
+            status = glCheckNamedFramebufferStatus(m_fbo.get(), GL_FRAMEBUFFER);
+        } else {
+            g_gl_state.bind_texture(0, GL_TEXTURE_2D, m_color.get());
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex_width, tex_height, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glBindRenderbuffer(GL_RENDERBUFFER, m_depth.get());
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, tex_width, tex_height);
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+            g_gl_state.bind_framebuffer(m_fbo.get());
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                                   m_color.get(), 0);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                                      m_depth.get());
+            status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            g_gl_state.bind_framebuffer(0);
+        }
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "Offscreen framebuffer is incomplete: 0x%x\n", status);
+            std::exit(1);
+        }
+    }
+
+   private:
+    float m_min_scale = 1.0f;
+    float m_max_scale = 1.0f;
+    float m_scale     = 1.0f;
+
+    GLHandle m_fbo;
+    GLHandle m_color;
+    GLHandle m_depth;
+
+    int m_fb_width     = 0;
+    int m_fb_height    = 0;
+    int m_scene_width  = 0;
+    int m_scene_height = 0;
+
+    double m_avg_time         = 0.0;
+    int m_frames_since_change = 0;
+};
+
+static DynamicResolution g_dynamic_resolution;
+
+// GPU time of frames from GL_TIME_ELAPSED queries, kept in a ring of NUM_QUERIES. A result is
+// only read once GL_QUERY_RESULT_AVAILABLE says it is ready, so the CPU never waits for the GPU.
+// A frame whose query is still pending is not timed.
+class GpuTimer {
+   public:
+    void init() {
+        glGenQueries(NUM_QUERIES, m_queries);
+    }
+
+    void release() {
+        glDeleteQueries(NUM_QUERIES, m_queries);
+        std::fill(m_queries, m_queries + NUM_QUERIES, 0);
+        std::fill(m_pending, m_pending + NUM_QUERIES, false);
+    }
+
+    void begin_frame() {
+        m_active = !m_pending[m_next] || read_result(m_next);
+        if (m_active) {
+            glBeginQuery(GL_TIME_ELAPSED, m_queries[m_next]);
+            g_gl_state.count_calls(1);
+        }
+    }
+
+    void end_frame() {
+        if (!m_active) {
+            return;
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        g_gl_state.count_calls(1);
+        m_pending[m_next] = true;
+        m_next            = (m_next + 1) % NUM_QUERIES;
+        if (m_pending[m_next]) {
+            read_result(m_next);
+        }
+    }
+
+    // 0 until the first query has been read
+    double get_seconds() const {
+        return m_last_s;
+    }
+
+   private:
+    static constexpr int NUM_QUERIES = 3;
+
+    // Returns false if the result of query i is not ready yet
+    bool read_result(int i) {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(m_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        g_gl_state.count_calls(1);
+        if (!available) {
+            return false;
+        }
+        GLuint64 elapsed_ns = 0;
+        glGetQueryObjectui64v(m_queries[i], GL_QUERY_RESULT, &elapsed_ns);
+        g_gl_state.count_calls(1);
+        m_pending[i] = false;
+        m_last_s     = elapsed_ns * 1e-9;
+        return true;
+    }
+
+    GLuint m_queries[NUM_QUERIES] = {};
+    bool m_pending[NUM_QUERIES]   = {};
+    int m_next                    = 0;
+    bool m_active                 = false;  // a query is running for the current frame
+    double m_last_s               = 0.0;
+};
+
+static GpuTimer g_gpu_timer;
+
+// Accumulates wall and process CPU time spent blocked while the scene is static
+class IdleMonitor {
+   public:
+    void begin_idle() {
+        m_wall_start = glfwGetTime();
+        m_cpu_start  = std::clock();
+    }
+
+    void end_idle() {
+        m_idle_wall_s += glfwGetTime() - m_wall_start;
+        m_idle_cpu_s += (double)(std::clock() - m_cpu_start) / CLOCKS_PER_SEC;
+    }
+
+    double get_idle_seconds() const {
+        return m_idle_wall_s;
+    }
+
+    // Percentage of one core used while idle
+    double get_cpu_usage() const {
+        return m_idle_wall_s > 0.0 ? 100.0 * m_idle_cpu_s / m_idle_wall_s : 0.0;
+    }
+
+   private:
+    double m_wall_start      = 0.0;
+    std::clock_t m_cpu_start = 0;
+    double m_idle_wall_s     = 0.0;
+    double m_idle_cpu_s      = 0.0;
+};
+
+static IdleMonitor g_idle_monitor;
+
+class GameManager {
+   public:
+    void init() {
+        const int color_material = m_scene.add_material(
+            create_material(Shading::COLOR, COLOR_VERT_SHADER_FILE, COLOR_FRAG_SHADER_FILE));
+        const int grass_material = m_scene.add_material(
+            create_material(Shading::TEXTURE, TEXTURE_VERT_SHADER_FILE, TEXTURE_FRAG_SHADER_FILE,
+                            load_texture(GRASS_TEX_FILE)));
+        Mesh ball_mesh;
+        Material ball_material;
+        load_ball(ball_mesh, ball_material);
+        const int ball_mesh_id     = m_scene.add_mesh(std::move(ball_mesh));
+        const int ball_material_id = m_scene.add_material(std::move(ball_material));
+
+        // The grid is drawn before the tiles so that its lines stay on top of them
+        const int cells_per_side = g_multi_balls > 0 ? MULTI_BALL_CELLS : 3;
+        m_scene.create_drawable(m_scene.add_mesh(create_grid_mesh(cells_per_side)), color_material,
+                                Layer::GRID);
+        glm::mat4 ground_mat = glm::mat4(1.0f);
+        ground_mat           = glm::translate(ground_mat, glm::vec3(0.0f, -RADIUS * 2, 0.0f));
+        ground_mat           = glm::scale(ground_mat, glm::vec3(32.0f));
+        m_scene.create_drawable(m_scene.add_mesh(create_ground_mesh()), grass_material,
+                                Layer::GROUND, ground_mat);
+        m_tile     = m_scene.create_drawable(m_scene.add_mesh(create_tile_mesh(WHITE)),
+                                             color_material, Layer::TILES);
+        m_red_tile = m_scene.create_drawable(m_scene.add_mesh(create_tile_mesh(RED)),
+                                             color_material, Layer::TILES);
+        m_scene.get_renderables().get(m_red_tile).visible = false;
+
+        if (g_multi_balls > 0) {
+            init_physics(ball_mesh_id, ball_material_id);
+        } else {
+            m_ball = m_scene.create_drawable(ball_mesh_id, ball_material_id);
+        }
+        m_hud.init();
+    }
+
+    void seed(unsigned int seed) {
+        m_seed = seed;
+        m_session.seed(seed);
+    }
+
+    const GameSession& get_session() const {
+        return m_session;
+    }
+
+    // Whether the last drawn frame is stale
+    bool needs_redraw() const {
+        if (m_physics) {
+            return true;
+        }
+        const GameState state = m_session.get_game_state();
+        return m_dirty || state == GameState::FALLING || state == GameState::JUGGLING;
+    }
+
+    void invalidate() {
+        m_dirty = true;
+    }
+
+    void main_loop() {
+        m_dirty = false;
+        if (g_show_overdraw) {
+            m_overdraw.begin();
+        }
+        if (m_physics) {
+            multi_ball_loop();
+        } else {
+            juggling_loop();
+        }
+        if (g_show_overdraw) {
+            const DynamicResolution& dr = g_dynamic_resolution;
+            m_overdraw.end(m_hud, g_use_dynamic_resolution ? dr.get_scene_width() : g_fb_width,
+                           g_use_dynamic_resolution ? dr.get_scene_height() : g_fb_height);
+        }
+    }
+
+    const OverdrawMeter& get_overdraw() const {
+        return m_overdraw;
+    }
+
+    void draw_hud(const FrameStats& stats) {
+        char text[256];
+        m_hud.begin();
+
+        if (m_physics) {
+            snprintf(text, sizeof(text), "KICKS %d", m_physics->get_score());
+        } else {
+            snprintf(text, sizeof(text), "SCORE %d", m_session.get_score());
+        }
+        m_hud.add_text(20.0f, 20.0f, 4.0f, HUD_WHITE, text);
+        const GLState::Counters& gl = g_gl_state.get_last_frame();
+        snprintf(text, sizeof(text),
+                 "FPS %.1f\nFRAME %.2f MS\nDRAWS %d  GL CALLS %d\nSTATE CHANGES %d  SKIPPED %d\n"
+                 "SYNC WAIT %.2f MS (MAX %.2f)%s",
+                 stats.get_fps(), stats.get_frame_time_ms(), gl.draw_calls, gl.gl_calls,
+                 gl.state_changes, gl.redundant, g_stream_buffer.get_wait_ms(),
+                 g_stream_buffer.get_max_wait_ms(),
+                 g_stream_buffer.is_persistent() ? "" : " ORPHANING");
+        m_hud.add_text(20.0f, 64.0f, 2.0f, HUD_WHITE, text);
+        if (g_use_dynamic_resolution) {
+            const DynamicResolution& dr = g_dynamic_resolution;
+            snprintf(text, sizeof(text), "SCALE %.2f (%dX%d)", dr.get_scale(),
+                     dr.get_scene_width(), dr.get_scene_height());
+            m_hud.add_text(20.0f, 204.0f, 2.0f, HUD_WHITE, text);
+        }
+        snprintf(text, sizeof(text), "IDLE %.1f S  CPU %.1f%%", g_idle_monitor.get_idle_seconds(),
+                 g_idle_monitor.get_cpu_usage());
+        m_hud.add_text(20.0f, 224.0f, 2.0f, HUD_WHITE, text);
+        const GpuResourceTracker::Usage& gpu = g_gpu_resources.get_total();
+        snprintf(text, sizeof(text), "GPU %.2f MB (PEAK %.2f MB)  OBJECTS %d",
+                 gpu.bytes / (1024.0 * 1024.0), gpu.peak_bytes / (1024.0 * 1024.0), gpu.count);
+        m_hud.add_text(20.0f, 244.0f, 2.0f, HUD_WHITE, text);
+        snprintf(text, sizeof(text), "ENTITIES %d  VISIBLE %d", m_scene.get_num_entities(),
+                 m_renderer.get_num_visible());
+        if (g_show_overdraw) {
+            const size_t length = std::strlen(text);
+            snprintf(text + length, sizeof(text) - length, "  OVERDRAW %.2f",
+                     m_overdraw.get_average());
+        }
+        m_hud.add_text(20.0f, 264.0f, 2.0f, HUD_WHITE, text);
+        if (m_physics) {
+            snprintf(text, sizeof(text), "BALLS %d  STEP %.2f MS  CONTACTS %d  THREADS %d",
+                     m_physics->get_size(), m_physics->get_step_ms(), m_physics->get_contacts(),
+                     m_physics->get_num_threads());
+            m_hud.add_text(20.0f, 284.0f, 2.0f, HUD_WHITE, text);
+        }
+
+        // Frame time graph with the frame budget as a red line
+        const float graph_x = 20.0f, graph_h = 80.0f, bar_w = 2.0f;
+        const float graph_y = (float)g_fb_height - 20.0f - graph_h;
+        const float px_per_ms = graph_h / (float)(2000.0 / FPS);
+        m_hud.add_rect(graph_x, graph_y, bar_w * FrameStats::HISTORY_SIZE, graph_h, HUD_SHADOW);
+        for (int i = 0; i < stats.get_size(); ++i) {
+            const float h = std::min(graph_h, stats.get_frame_time_ms(i) * px_per_ms);
+            m_hud.add_rect(graph_x + bar_w * i, graph_y + graph_h - h, bar_w, h, HUD_WHITE);
+        }
+        m_hud.add_rect(graph_x, graph_y + graph_h * 0.5f, bar_w * FrameStats::HISTORY_SIZE, 1.0f,
+                       HUD_RED);
+
+        const float center_x  = g_fb_width * 0.5f;
+        const GameState state = m_physics ? GameState::JUGGLING : m_session.get_game_state();
+        if (state == GameState::BEFORE_START) {
+            const char* keys = "Q W E\nA S D\nZ X C";
+            const char* msg  = "PRESS SPACE TO START";
+            m_hud.add_text(center_x - Hud::text_width(3.0f, "Q W E") * 0.5f, 300.0f, 3.0f,
+                           HUD_WHITE, keys);
+            m_hud.add_text(center_x - Hud::text_width(3.0f, msg) * 0.5f, 410.0f, 3.0f, HUD_WHITE,
+                           msg);
+        } else if (state == GameState::FAILED) {
+            const char* msg = "PRESS SPACE TO RESTART";
+            m_hud.add_text(center_x - Hud::text_width(6.0f, "FAILED!") * 0.5f, 300.0f, 6.0f,
+                           HUD_RED, "FAILED!");
+            m_hud.add_text(center_x - Hud::text_width(3.0f, msg) * 0.5f, 370.0f, 3.0f, HUD_WHITE,
+                           msg);
+        }
 
-    void init() {
-        m_ball.init();
-        m_grid.init();
-        m_ground.init();
-        m_tile.init();
-        m_red_tile.init();
+        m_hud.draw(g_fb_width, g_fb_height);
     }
 
-    void main_loop() {
-        m_grid.draw();
-        m_ground.draw();
-        m_tile.draw();
-
-        if (m_game_state == GameState::BEFORE_START) {
-            m_ball.draw_before_starting();
-        } else if (m_game_state == GameState::FALLING) {
-            m_ball.draw_before_starting();
-            if (m_ball.get_falling_pos() < 0.0f) {
-                m_game_state = GameState::JUGGLING;
-                printf("%d\n", ++m_count);
-                m_ball.set_dest();
+    void keyboard_event(GLFWwindow* window, int key, int scancode, int action, int mods) {
+        if (m_physics) {
+            if (action != GLFW_RELEASE) {
+                move_physics_tile(key);
             }
-            m_ball.update_fall();
-        } else if (m_game_state == GameState::JUGGLING) {
-            m_ball.draw_during_game();
-            if (is_failure()) {
-                m_game_state = GameState::FAILED;
+            return;
+        }
+        if (action == GLFW_PRESS && m_session.key_press(key)) {
+            m_dirty = true;
+        }
+    }
+
+   private:
+    void init_physics(int ball_mesh, int ball_material) {
+        const int hardware_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        const int threads          = g_physics_threads > 0 ? g_physics_threads : hardware_threads;
+        m_physics                  = std::make_unique<BallPhysics>();
+        m_physics->init(g_multi_balls, MULTI_BALL_CELLS, threads, m_seed);
+
+        // Random orientations, so that the balls do not all show the same side
+        std::minstd_rand rng(m_seed);
+        std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+        for (int i = 0; i < g_multi_balls; ++i) {
+            const float yaw          = glm::radians(angle(rng));
+            const float pitch        = glm::radians(angle(rng));
+            const glm::mat4 rotation = glm::rotate(yaw, glm::vec3(0.0f, 1.0f, 0.0f))
+                                       * glm::rotate(pitch, glm::vec3(1.0f, 0.0f, 0.0f));
+            const Entity entity      = m_scene.create_drawable(ball_mesh, ball_material);
+            m_scene.get_bodies().add(entity, PhysicsBody{i, glm::mat3(rotation)});
+        }
+    }
+
+    void juggling_loop() {
+        const GameState state    = m_session.get_game_state();
+        const BallMotion& motion = m_session.get_motion();
+        place_tile(m_tile, CELL_POS[m_session.get_tile_pos_idx()]);
+        if (state == GameState::BEFORE_START || state == GameState::FALLING) {
+            m_scene.get_transforms().get(m_ball).model_mat = motion.calc_falling_mat();
+        } else {
+            m_scene.get_transforms().get(m_ball).model_mat = motion.calc_juggling_mat();
+        }
+        m_scene.get_renderables().get(m_red_tile).visible = state == GameState::FAILED;
+        if (state == GameState::FAILED) {
+            place_tile(m_red_tile, CELL_POS[m_session.get_ball_target()]);
+        }
+        m_renderer.draw(m_scene);
+
+        const GameEvent event = m_session.step();
+        if (event == GameEvent::SCORED) {
+            print_score(m_session.get_score());
+        } else if (event == GameEvent::FAILED) {
+            m_dirty = true;
+            if (g_verbose) {
                 printf(
                     "Failed!\n"
                     "Score: %d\n"
                     "Press space to restart.\n\n",
-                    m_count);
-            } else {
-                if (m_ball.is_fallen()) {
-                    printf("%d\n", ++m_count);
-                    m_ball.set_dest();
-                }
-                m_ball.update_juggle();
+                    m_session.get_score());
             }
-        } else if (m_game_state == GameState::FAILED) {
-            m_ball.draw_during_game();
-            m_red_tile.set_pos_number(m_ball.get_next_pos_idx());
-            m_red_tile.draw();
         }
     }
 
-    void keyboard_event(GLFWwindow* window, int key, int scancode, int action, int mods) {
-        if (action == GLFW_PRESS && m_game_state == GameState::JUGGLING) {
-            m_tile.set_pos_number_by_key(key);
-        }
-        if (action == GLFW_PRESS && (char)key == ' '
-            && (m_game_state == GameState::BEFORE_START || m_game_state == GameState::FAILED)) {
-            m_game_state = GameState::FALLING;
-            reset();
-        }
+    void multi_ball_loop() {
+        place_tile(m_tile, m_physics->get_tile_center());
+        m_scene.sync_bodies(*m_physics);
+        m_renderer.draw(m_scene);
+
+        m_physics->step((float)(1.0 / FPS));
     }
 
-   private:
-    bool is_failure() {
-        if (!m_ball.is_fallen()) {
-            return false;
-        }
-        if (m_ball.get_next_pos_idx() == m_tile.get_pos_idx()) {
-            return false;
+    // The tile lies on the grid under the ball centered at center
+    void place_tile(Entity tile, const glm::vec3& center) {
+        m_scene.get_transforms().get(tile).model_mat
+            = glm::translate(glm::mat4(1.0f), center + glm::vec3(0.0f, -RADIUS, 0.0f));
+    }
+
+    // The field is too large for one key per cell, so the arrow keys move the tile
+    void move_physics_tile(int key) {
+        switch (key) {
+            case GLFW_KEY_LEFT:
+                m_physics->move_tile(-1, 0);
+                break;
+            case GLFW_KEY_RIGHT:
+                m_physics->move_tile(1, 0);
+                break;
+            case GLFW_KEY_UP:
+                m_physics->move_tile(0, -1);
+                break;
+            case GLFW_KEY_DOWN:
+                m_physics->move_tile(0, 1);
+                break;
+            default:
+                break;
         }
-        return true;
     }
 
-    void reset() {
-        m_ball.reset();
-        m_tile.set_pos_number(4);
-        m_count = 0;
+    static void print_score(int count) {
+        if (g_verbose) {
+            printf("%d\n", count);
+        }
     }
 
    private:
-    GameState m_game_state;
+    GameSession m_session;
+
+    Scene m_scene;
+    SceneRenderer m_renderer;
+    Entity m_ball     = 0;  // juggling mode only
+    Entity m_tile     = 0;
+    Entity m_red_tile = 0;
+    Hud m_hud;
+    OverdrawMeter m_overdraw;
 
-    Ball m_ball;
-    Grid m_grid;
-    Tile m_tile;
-    Tile m_red_tile;
-    Ground m_ground;
+    std::unique_ptr<BallPhysics> m_physics;  // multi-ball mode only
 
-    int m_count;
+    unsigned int m_seed = 0;
+    bool m_dirty        = true;
 };
 
-static GameManager g_game;
+// Created once the GL context exists and destroyed before it goes away
+static std::unique_ptr<GameManager> g_game;
+static FrameStats g_frame_stats;
 
 void resize_gl(GLFWwindow* window, int width, int height) {
     g_win_width  = width;
@@ -872,13 +3445,56 @@ void resize_gl(GLFWwindow* window, int width, int height) {
     int render_buffer_width, render_buffer_height;
     glfwGetFramebufferSize(window, &render_buffer_width, &render_buffer_height);
     glViewport(0, 0, render_buffer_width, render_buffer_height);
+    g_fb_width  = render_buffer_width;
+    g_fb_height = render_buffer_height;
     g_proj_mat = glm::perspective(45.0f, (float)g_win_width / (float)g_win_height, 0.1f, 1000.0f);
+    g_game->invalidate();
+}
+
+void refresh_gl(GLFWwindow* window) {
+    g_game->invalidate();
 }
 
 void keyboard_event(GLFWwindow* window, int key, int scancode, int action, int mods) {
-    g_game.keyboard_event(window, key, scancode, action, mods);
+    if (action == GLFW_PRESS && key == GLFW_KEY_M) {
+        g_gpu_resources.print_summary(stdout);
+    }
+    if (action == GLFW_PRESS && key == GLFW_KEY_O) {
+        g_show_overdraw = !g_show_overdraw;
+        g_game->invalidate();
+    }
+    g_game->keyboard_event(window, key, scancode, action, mods);
 }
 
+// Scripted player for the benchmark. It starts the game, moves the tile under the ball as soon
+// as its destination is known, and misses on purpose every MISS_INTERVAL bounces so that the
+// failure and restart paths are exercised as well.
+class BenchmarkPlayer {
+   public:
+    void play(GameManager& game) {
+        const GameSession& session = game.get_session();
+        const GameState state      = session.get_game_state();
+        if (state == GameState::BEFORE_START || state == GameState::FAILED) {
+            press(game, ' ');
+        } else if (state == GameState::JUGGLING && session.get_score() != m_last_score) {
+            m_last_score = session.get_score();
+            if (m_last_score % MISS_INTERVAL != 0) {
+                press(game, CELL_KEYS[session.get_ball_target()]);
+            }
+        }
+    }
+
+   private:
+    static constexpr int MISS_INTERVAL = 25;
+
+    static void press(GameManager& game, char key) {
+        game.keyboard_event(NULL, key, 0, GLFW_PRESS, 0);
+        game.keyboard_event(NULL, key, 0, GLFW_RELEASE, 0);
+    }
+
+    int m_last_score = -1;
+};
+
 void print_how_to_play() {
     printf(
         "\n"
@@ -896,16 +3512,758 @@ void print_how_to_play() {
         "  Bottom left   - Z\n"
         "  Bottom center - X\n"
         "  Bottom right  - C\n\n"
-        "Your score will be displayed on the console.\n\n"
+        "Your score will be displayed on the screen and the console.\n"
+        "Press M to print the GPU memory usage.\n"
+        "Press O to show the overdraw.\n\n"
         "Press space to start.\n\n");
 }
 
+//////////////////////////////////
+// headless server
+//////////////////////////////////
+
+#ifdef __linux__
+
+static volatile std::sig_atomic_t g_stop_requested = 0;
+
+void request_stop(int signum) {
+    g_stop_requested = 1;
+}
+
+// Let the process hold one descriptor per session
+void raise_fd_limit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+bool make_socket_address(const std::string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long: %s\n", path.c_str());
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// Make path free for bind(). Only a socket that refuses connections, i.e. one left behind by a
+// server that is gone, is removed; any other file and the socket of a live server are kept.
+bool remove_stale_socket(const std::string& path, const sockaddr_un& addr) {
+    struct stat info;
+    if (lstat(path.c_str(), &info) < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        fprintf(stderr, "Failed to check %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!S_ISSOCK(info.st_mode)) {
+        fprintf(stderr, "%s exists and is not a socket\n", path.c_str());
+        return false;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create a socket: %s\n", strerror(errno));
+        return false;
+    }
+    const bool refused
+        = connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0 && errno == ECONNREFUSED;
+    close(fd);
+    if (!refused) {
+        fprintf(stderr, "%s is in use by another server\n", path.c_str());
+        return false;
+    }
+    if (unlink(path.c_str()) < 0) {
+        fprintf(stderr, "Failed to remove %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void write_u32(unsigned char* dst, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        dst[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+uint32_t read_u32(const unsigned char* src) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= (uint32_t)src[i] << (8 * i);
+    }
+    return value;
+}
+
+// Sessions of one server thread. The acceptor hands connected sockets over through a queue and
+// wakes the thread with an eventfd; from then on the socket and its session belong to the thread
+// alone. Every session steps on a shared 1 / FPS timer, and a state message is sent only when
+// what a client can see has changed.
+class ServerWorker {
+   public:
+    struct Stats {
+        int sessions         = 0;  // open at the time of the report
+        long long opened     = 0;
+        long long ticks      = 0;
+        double tick_ms_total = 0.0;
+        double tick_ms_max   = 0.0;
+        long long missed     = 0;  // timer periods dropped because the worker fell behind
+    };
+
+    ~ServerWorker() {
+        if (m_thread.joinable()) {
+            stop();
+        }
+    }
+
+    void start(unsigned int seed) {
+        m_seeder.seed(seed);
+        m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        m_wake_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (m_epoll_fd < 0 || m_wake_fd < 0 || m_timer_fd < 0) {
+            fprintf(stderr, "Failed to create the worker descriptors: %s\n", strerror(errno));
+            std::exit(1);
+        }
+
+        const long period_ns = (long)(1.0e9 / FPS);
+        itimerspec timer;
+        timer.it_interval.tv_sec  = 0;
+        timer.it_interval.tv_nsec = period_ns;
+        timer.it_value            = timer.it_interval;
+        timerfd_settime(m_timer_fd, 0, &timer, NULL);
+
+        watch(m_wake_fd);
+        watch(m_timer_fd);
+        m_running = true;
+        m_thread  = std::thread(&ServerWorker::run, this);
+    }
+
+    void stop() {
+        m_running = false;
+        wake();
+        m_thread.join();
+        for (const auto& it : m_connections) {
+            close(it.first);
+        }
+        m_connections.clear();
+        close(m_timer_fd);
+        close(m_wake_fd);
+        close(m_epoll_fd);
+    }
+
+    // Called from the acceptor thread
+    void hand_over(int fd) {
+        {
+            std::lock_guard<std::mutex> lock(m_pending_mutex);
+            m_pending.push_back(fd);
+        }
+        wake();
+    }
+
+    // Statistics since the last call
+    Stats take_stats() {
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        Stats stats    = m_stats;
+        m_stats        = Stats();
+        stats.sessions = m_session_count;
+        return stats;
+    }
+
+   private:
+    struct Connection {
+        GameSession session;
+        unsigned char sent[MSG_STATE_SIZE] = {};  // last state delivered, tick excluded
+        bool has_sent                      = false;
+    };
+
+    static constexpr int MAX_EVENTS         = 256;
+    static constexpr int MAX_CATCH_UP_TICKS = 4;
+
+    void run() {
+        epoll_event events[MAX_EVENTS];
+        while (m_running) {
+            const int n = epoll_wait(m_epoll_fd, events, MAX_EVENTS, -1);
+            if (n < 0 && errno != EINTR) {
+                fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+                std::exit(1);
+            }
+            for (int i = 0; i < n; ++i) {
+                const int fd = events[i].data.fd;
+                if (fd == m_wake_fd) {
+                    uint64_t count;
+                    while (read(m_wake_fd, &count, sizeof(count)) > 0) {
+                    }
+                    adopt_pending();
+                } else if (fd == m_timer_fd) {
+                    uint64_t expirations;
+                    if (read(m_timer_fd, &expirations, sizeof(expirations)) > 0) {
+                        catch_up(expirations);
+                    }
+                } else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    drop(fd);
+                } else {
+                    receive(fd);
+                }
+            }
+        }
+    }
+
+    void watch(int fd) {
+        epoll_event event;
+        event.events  = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            fprintf(stderr, "epoll_ctl failed: %s\n", strerror(errno));
+            std::exit(1);
+        }
+    }
+
+    void wake() {
+        const uint64_t one = 1;
+        if (write(m_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            fprintf(stderr, "Failed to wake a worker: %s\n", strerror(errno));
+        }
+    }
+
+    void adopt_pending() {
+        std::vector<int> fds;
+        {
+            std::lock_guard<std::mutex> lock(m_pending_mutex);
+            fds.swap(m_pending);
+        }
+        for (int fd : fds) {
+            Connection& connection = m_connections[fd];
+            connection.session.seed((unsigned int)m_seeder());
+            watch(fd);
+            send_state(fd, connection);
+        }
+        m_session_count += (int)fds.size();
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        m_stats.opened += (long long)fds.size();
+    }
+
+    void drop(int fd) {
+        if (m_connections.erase(fd) > 0) {
+            close(fd);
+            --m_session_count;
+        }
+    }
+
+    void receive(int fd) {
+        auto it = m_connections.find(fd);
+        if (it == m_connections.end()) {
+            return;
+        }
+        unsigned char msg[MSG_KEY_SIZE];
+        while (true) {
+            const ssize_t size = recv(fd, msg, sizeof(msg), 0);
+            if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (size <= 0) {
+                drop(fd);
+                return;
+            }
+            if (size == MSG_KEY_SIZE && msg[0] == MSG_KEY
+                && it->second.session.key_press(msg[1])) {
+                send_state(fd, it->second);
+            }
+        }
+    }
+
+    // Step once per timer period that passed, up to MAX_CATCH_UP_TICKS, so that sessions keep
+    // their speed after a slow tick. Periods past that are dropped and reported as missed.
+    void catch_up(uint64_t expirations) {
+        const uint64_t steps = std::min(expirations, (uint64_t)MAX_CATCH_UP_TICKS);
+        for (uint64_t i = 0; i < steps; ++i) {
+            tick();
+        }
+        if (expirations > steps) {
+            std::lock_guard<std::mutex> lock(m_stats_mutex);
+            m_stats.missed += (long long)(expirations - steps);
+        }
+    }
+
+    void tick() {
+        const auto start = std::chrono::steady_clock::now();
+        ++m_tick;
+
+        std::vector<int> broken;
+        for (auto& entry : m_connections) {
+            entry.second.session.step();
+            if (!send_state(entry.first, entry.second)) {
+                broken.push_back(entry.first);
+            }
+        }
+        for (int fd : broken) {
+            drop(fd);
+        }
+
+        const std::chrono::duration<double, std::milli> elapsed
+            = std::chrono::steady_clock::now() - start;
+        std::lock_guard<std::mutex> lock(m_stats_mutex);
+        ++m_stats.ticks;
+        m_stats.tick_ms_total += elapsed.count();
+        m_stats.tick_ms_max = std::max(m_stats.tick_ms_max, elapsed.count());
+    }
+
+    // Send the session state if it differs from what the client last received. Returns false
+    // when the connection is gone; a full socket buffer just postpones the update.
+    bool send_state(int fd, Connection& connection) {
+        const GameSession& session = connection.session;
+        unsigned char msg[MSG_STATE_SIZE];
+        msg[0] = MSG_STATE;
+        msg[1] = (unsigned char)session.get_game_state();
+        msg[2] = (unsigned char)session.get_tile_pos_idx();
+        msg[3] = (unsigned char)session.get_ball_target();
+        write_u32(msg + 4, (uint32_t)session.get_score());
+        write_u32(msg + 8, 0);
+        if (connection.has_sent && memcmp(msg, connection.sent, MSG_STATE_SIZE) == 0) {
+            return true;
+        }
+
+        unsigned char packet[MSG_STATE_SIZE];
+        memcpy(packet, msg, MSG_STATE_SIZE);
+        write_u32(packet + 8, m_tick);
+        if (send(fd, packet, MSG_STATE_SIZE, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        memcpy(connection.sent, msg, MSG_STATE_SIZE);
+        connection.has_sent = true;
+        return true;
+    }
+
+   private:
+    int m_epoll_fd = -1;
+    int m_wake_fd  = -1;
+    int m_timer_fd = -1;
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+
+    std::mutex m_pending_mutex;
+    std::vector<int> m_pending;
+
+    std::unordered_map<int, Connection> m_connections;
+    std::minstd_rand m_seeder;
+    uint32_t m_tick = 0;
+
+    std::mutex m_stats_mutex;
+    Stats m_stats;
+    std::atomic<int> m_session_count{0};
+};
+
+// Accept connections on a UNIX socket and shard the sessions across worker threads. Runs until
+// SIGINT or SIGTERM, printing the session rate and tick latency every second.
+int run_server(const std::string& path, int num_workers) {
+    raise_fd_limit();
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
+
+    sockaddr_un addr;
+    if (!make_socket_address(path, addr) || !remove_stale_socket(path, addr)) {
+        return 1;
+    }
+    const int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (const sockaddr*)&addr, sizeof(addr)) < 0
+        || listen(listen_fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event;
+    event.events  = EPOLLIN;
+    event.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    std::vector<ServerWorker> workers(num_workers);
+    for (int i = 0; i < num_workers; ++i) {
+        workers[i].start(g_seed + (unsigned int)i);
+    }
+    printf("Serving on %s with %d workers\n", path.c_str(), num_workers);
+    fflush(stdout);
+
+    int next_worker  = 0;
+    auto last_report = std::chrono::steady_clock::now();
+    while (!g_stop_requested) {
+        epoll_event ready;
+        epoll_wait(epoll_fd, &ready, 1, 100);
+        while (true) {
+            const int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    fprintf(stderr, "accept failed: %s\n", strerror(errno));
+                }
+                break;
+            }
+            workers[next_worker].hand_over(fd);
+            next_worker = (next_worker + 1) % num_workers;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        const std::chrono::duration<double> since_report = now - last_report;
+        if (since_report.count() >= 1.0) {
+            ServerWorker::Stats total;
+            for (ServerWorker& worker : workers) {
+                const ServerWorker::Stats stats = worker.take_stats();
+                total.sessions += stats.sessions;
+                total.opened += stats.opened;
+                total.ticks += stats.ticks;
+                total.tick_ms_total += stats.tick_ms_total;
+                total.tick_ms_max = std::max(total.tick_ms_max, stats.tick_ms_max);
+                total.missed += stats.missed;
+            }
+            printf("sessions %d  new %.0f/s  tick mean %.3f ms  max %.3f ms  missed %lld\n",
+                   total.sessions, total.opened / since_report.count(),
+                   total.ticks > 0 ? total.tick_ms_total / total.ticks : 0.0, total.tick_ms_max,
+                   total.missed);
+            fflush(stdout);
+            last_report = now;
+        }
+    }
+
+    for (ServerWorker& worker : workers) {
+        worker.stop();
+    }
+    close(epoll_fd);
+    close(listen_fd);
+    unlink(path.c_str());
+    return 0;
+}
+
+// Open num_clients sessions on the server and play each with a bot for duration seconds. The bots
+// start games, follow the ball and miss every MISS_INTERVAL bounces, like BenchmarkPlayer.
+int run_load_client(const std::string& path, int num_clients, double duration) {
+    static constexpr int MISS_INTERVAL = 25;
+    static constexpr int MAX_EVENTS    = 256;
+
+    raise_fd_limit();
+    sockaddr_un addr;
+    if (!make_socket_address(path, addr)) {
+        return 1;
+    }
+
+    const auto connect_start = std::chrono::steady_clock::now();
+    const int epoll_fd       = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<int> fds;
+    for (int i = 0; i < num_clients; ++i) {
+        const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "Failed to connect client %d: %s\n", i, strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            break;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        epoll_event event;
+        event.events  = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        fds.push_back(fd);
+    }
+    const std::chrono::duration<double> connect_time
+        = std::chrono::steady_clock::now() - connect_start;
+
+    long long updates = 0, keys = 0, games = 0, closed = 0;
+    const auto play_start = std::chrono::steady_clock::now();
+    epoll_event events[MAX_EVENTS];
+    while (true) {
+        const std::chrono::duration<double> elapsed
+            = std::chrono::steady_clock::now() - play_start;
+        if (elapsed.count() >= duration) {
+            break;
+        }
+        const int timeout_ms = (int)std::ceil((duration - elapsed.count()) * 1000.0);
+        const int n          = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+        for (int i = 0; i < n; ++i) {
+            const int fd = events[i].data.fd;
+            unsigned char msg[MSG_STATE_SIZE];
+            ssize_t size;
+            while ((size = recv(fd, msg, sizeof(msg), 0)) == MSG_STATE_SIZE) {
+                if (msg[0] != MSG_STATE) {
+                    continue;
+                }
+                ++updates;
+                const GameState state = (GameState)msg[1];
+                const int tile        = msg[2];
+                const int target      = msg[3];
+                const uint32_t score  = read_u32(msg + 4);
+
+                unsigned char key = 0;
+                if (state == GameState::FAILED) {
+                    ++games;
+                }
+                if (state == GameState::BEFORE_START || state == GameState::FAILED) {
+                    key = ' ';
+                } else if (state == GameState::JUGGLING && tile != target
+                           && score % MISS_INTERVAL != 0) {
+                    key = (unsigned char)CELL_KEYS[target];
+                }
+                if (key != 0) {
+                    const unsigned char press[MSG_KEY_SIZE] = {MSG_KEY, key};
+                    if (send(fd, press, sizeof(press), MSG_NOSIGNAL) == MSG_KEY_SIZE) {
+                        ++keys;
+                    }
+                }
+            }
+            if (size == 0 || (size < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                ++closed;
+            }
+        }
+    }
+    const std::chrono::duration<double> play_time = std::chrono::steady_clock::now() - play_start;
+
+    for (int fd : fds) {
+        close(fd);
+    }
+    close(epoll_fd);
+
+    printf(
+        "clients %zu  connect %.3f s (%.0f/s)\n"
+        "updates %.0f/s  keys %.0f/s  failed games %lld  closed by server %lld\n",
+        fds.size(), connect_time.count(), fds.size() / std::max(connect_time.count(), 1e-9),
+        updates / play_time.count(), keys / play_time.count(), games, closed);
+    return (int)fds.size() == num_clients ? 0 : 1;
+}
+
+#else
+
+int run_server(const std::string& path, int num_workers) {
+    fprintf(stderr, "The server is only available on Linux.\n");
+    return 1;
+}
+
+int run_load_client(const std::string& path, int num_clients, double duration) {
+    fprintf(stderr, "The load client is only available on Linux.\n");
+    return 1;
+}
+
+#endif
+
 //////////////////////////////////
 // main function
 //////////////////////////////////
 
+// Draw the scene and the HUD into the back buffer
+void render_frame() {
+    g_stream_buffer.begin_frame();
+    if (g_use_dynamic_resolution) {
+        g_dynamic_resolution.begin_scene(g_fb_width, g_fb_height);
+    }
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    g_gl_state.count_calls(1);
+    g_game->main_loop();
+    if (g_use_dynamic_resolution) {
+        g_dynamic_resolution.end_scene();
+    }
+    g_game->draw_hud(g_frame_stats);
+    g_stream_buffer.end_frame();
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    const size_t rank = (size_t)std::ceil(p * sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// Play g_benchmark_frames frames with scripted input as fast as possible and print the results
+// as JSON on stdout
+int run_benchmark(GLFWwindow* window, double startup_ms) {
+    BenchmarkPlayer player;
+    std::vector<double> frame_times;
+    frame_times.reserve(g_benchmark_frames);
+    long long draw_calls = 0, gl_calls = 0, state_changes = 0;
+
+    double prev_time = glfwGetTime();
+    for (int frame = 0; frame < g_benchmark_frames; ++frame) {
+        const double start_time = glfwGetTime();
+        player.play(*g_game);
+        render_frame();
+        glfwSwapBuffers(window);
+        // Include the GPU work of this frame
+        glFinish();
+        glfwPollEvents();
+        const double end_time = glfwGetTime();
+
+        const GLState::Counters& counters = g_gl_state.get_current_frame();
+        draw_calls += counters.draw_calls;
+        gl_calls += counters.gl_calls;
+        state_changes += counters.state_changes;
+        g_gl_state.end_frame();
+        g_frame_stats.add_frame(end_time - prev_time, end_time - start_time);
+        frame_times.push_back((end_time - start_time) * 1000.0);
+        prev_time = end_time;
+    }
+
+    std::vector<double> sorted = frame_times;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (double t : frame_times) {
+        sum += t;
+    }
+    const double n = (double)frame_times.size();
+
+    // Only measured with --overdraw, since the readback stalls every frame
+    char overdraw[32] = "null";
+    if (g_show_overdraw) {
+        snprintf(overdraw, sizeof(overdraw), "%.4f", g_game->get_overdraw().get_mean_average());
+    }
+
+    std::string renderer = (const char*)glGetString(GL_RENDERER);
+    for (char& c : renderer) {
+        if (c == '"' || c == '\\') {
+            c = ' ';
+        }
+    }
+
+    printf(
+        "{\"benchmark\": \"football-juggling\", \"renderer\": \"%s\", \"width\": %d, "
+        "\"height\": %d, \"seed\": %u, \"frames\": %d, \"startup_ms\": %.3f, "
+        "\"frame_ms\": {\"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f}, "
+        "\"draw_calls_per_frame\": %.2f, \"gl_calls_per_frame\": %.2f, "
+        "\"state_changes_per_frame\": %.2f, \"final_score\": %d, \"gpu_bytes\": %lld, "
+        "\"gpu_peak_bytes\": %lld, \"overdraw\": %s}\n",
+        renderer.c_str(), g_fb_width, g_fb_height, g_seed, g_benchmark_frames, startup_ms,
+        sum / n, percentile(sorted, 0.5), percentile(sorted, 0.99), sorted.back(),
+        draw_calls / n, gl_calls / n, state_changes / n, g_game->get_session().get_score(),
+        g_gpu_resources.get_total().bytes, g_gpu_resources.get_total().peak_bytes, overdraw);
+    return 0;
+}
+
+// Delete every GL object while the context is still current, then report what was left
+void shutdown_gl() {
+    if (g_verbose) {
+        printf("GPU resources at exit:\n");
+        g_gpu_resources.print_summary(stdout);
+    }
+    g_game.reset();
+    g_dynamic_resolution.release();
+    g_stream_buffer.release();
+    g_gpu_timer.release();
+
+    const GpuResourceTracker::Usage& leaked = g_gpu_resources.get_total();
+    if (leaked.count != 0) {
+        fprintf(stderr, "%d GL objects (%.1f KB) were not released\n", leaked.count,
+                leaked.bytes / 1024.0);
+    }
+    glfwTerminate();
+}
+
+void print_usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --min-scale <s>          Lowest render scale of dynamic resolution (default 0.5)\n"
+            "  --max-scale <s>          Highest render scale of dynamic resolution (default 1.0)\n"
+            "  --no-dynamic-resolution  Render the scene at the window resolution\n"
+            "  --ball-impostor          Ray-trace the ball on a quad instead of drawing the mesh\n"
+            "  --overdraw               Show the fragments per pixel and print their average\n"
+            "  --no-front-to-back       Sort draws by material only, not front to back\n"
+            "  --multi-ball <n>         Simulate n balls with physics on a 16x16 field\n"
+            "  --physics-threads <n>    Threads for the contact pass (default: hardware threads)\n"
+            "  --benchmark <frames>     Play scripted input in a hidden window and print timings\n"
+            "  --seed <n>               Random seed (default: time; 1 in benchmark)\n"
+            "  --asset-dir <dir>        Read shaders and data from <dir> instead of the binary\n"
+            "  --server <socket>        Host headless game sessions on a UNIX socket (Linux)\n"
+            "  --workers <n>            Server threads (default: one per hardware thread)\n"
+            "  --load-client <socket>   Play bot sessions against a server and print rates\n"
+            "  --clients <n>            Sessions opened by the load client (default 1000)\n"
+            "  --duration <s>           Seconds the load client plays (default 10)\n",
+            program);
+}
+
+bool parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value  = i + 1 < argc;
+        if (arg == "--min-scale" && has_value) {
+            g_min_render_scale = (float)std::atof(argv[++i]);
+        } else if (arg == "--max-scale" && has_value) {
+            g_max_render_scale = (float)std::atof(argv[++i]);
+        } else if (arg == "--no-dynamic-resolution") {
+            g_use_dynamic_resolution = false;
+        } else if (arg == "--ball-impostor") {
+            g_use_ball_impostor = true;
+        } else if (arg == "--overdraw") {
+            g_show_overdraw = true;
+        } else if (arg == "--no-front-to-back") {
+            g_sort_front_to_back = false;
+        } else if (arg == "--multi-ball" && has_value) {
+            g_multi_balls = std::atoi(argv[++i]);
+        } else if (arg == "--physics-threads" && has_value) {
+            g_physics_threads = std::atoi(argv[++i]);
+        } else if (arg == "--benchmark" && has_value) {
+            g_benchmark_frames = std::atoi(argv[++i]);
+            if (g_benchmark_frames <= 0) {
+                return false;
+            }
+        } else if (arg == "--seed" && has_value) {
+            g_seed           = (unsigned int)std::strtoul(argv[++i], NULL, 10);
+            g_use_fixed_seed = true;
+        } else if (arg == "--asset-dir" && has_value) {
+            g_asset_dir = argv[++i];
+            if (!g_asset_dir.empty() && g_asset_dir.back() != '/') {
+                g_asset_dir += '/';
+            }
+        } else if (arg == "--server" && has_value) {
+            g_server_socket = argv[++i];
+        } else if (arg == "--workers" && has_value) {
+            g_server_workers = std::atoi(argv[++i]);
+        } else if (arg == "--load-client" && has_value) {
+            g_load_client_socket = argv[++i];
+        } else if (arg == "--clients" && has_value) {
+            g_load_clients = std::atoi(argv[++i]);
+        } else if (arg == "--duration" && has_value) {
+            g_load_duration = std::atof(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+    return g_min_render_scale > 0.0f && g_min_render_scale <= g_max_render_scale
+           && g_server_workers >= 0 && g_load_clients > 0 && g_load_duration > 0.0
+           && g_multi_balls >= 0 && g_physics_threads >= 0;
+}
+
 int main(int argc, char** argv) {
-    std::srand((unsigned int)time(NULL));
+    const auto start_time = std::chrono::steady_clock::now();
+
+    if (!parse_args(argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (g_benchmark_frames > 0) {
+        // Reproducible runs: fixed seed and resolution, machine-readable output only
+        g_verbose                = false;
+        g_use_dynamic_resolution = false;
+        if (!g_use_fixed_seed) {
+            g_seed = 1;
+        }
+    } else if (!g_use_fixed_seed) {
+        g_seed = (unsigned int)time(NULL);
+    }
+
+    if (g_multi_balls > 0) {
+        // Draw the balls as impostors and back the camera off to see the whole field
+        g_use_ball_impostor = true;
+        g_view_mat          = glm::lookAt(glm::vec3(0.0f, 26.0f, 30.0f), glm::vec3(0.0f),
+                                          glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    // Headless modes need neither a window nor a GL context
+    if (!g_server_socket.empty()) {
+        const int hardware_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        const int workers          = g_server_workers > 0 ? g_server_workers : hardware_threads;
+        return run_server(g_server_socket, workers);
+    }
+    if (!g_load_client_socket.empty()) {
+        return run_load_client(g_load_client_socket, g_load_clients, g_load_duration);
+    }
 
     if (glfwInit() == GL_FALSE) {
         fprintf(stderr, "Initialization failed!\n");
@@ -915,6 +4273,9 @@ int main(int argc, char** argv) {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (g_benchmark_frames > 0) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
 
     GLFWwindow* window
         = glfwCreateWindow(g_win_width, g_win_height, g_win_title.c_str(), NULL, NULL);
@@ -935,22 +4296,64 @@ int main(int argc, char** argv) {
     }
 
     glfwSetWindowSizeCallback(window, resize_gl);
-    glEnable(GL_DEPTH_TEST);
+    glfwSetWindowRefreshCallback(window, refresh_gl);
+    glfwGetFramebufferSize(window, &g_fb_width, &g_fb_height);
+    g_gl_state.set_enabled(GL_DEPTH_TEST, true);
+    g_gl_state.set_enabled(GL_TEXTURE_CUBE_MAP_SEAMLESS, true);
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-    g_game.init();
+    g_stream_buffer.init(STREAM_SEGMENT_SIZE);
+    g_gpu_timer.init();
+    g_dynamic_resolution.init(g_min_render_scale, g_max_render_scale);
+    g_game = std::make_unique<GameManager>();
+    g_game->seed(g_seed);
+    g_game->init();
+
+    if (g_benchmark_frames > 0) {
+        glfwSwapInterval(0);
+        const std::chrono::duration<double, std::milli> startup
+            = std::chrono::steady_clock::now() - start_time;
+        const int result = run_benchmark(window, startup.count());
+        shutdown_gl();
+        return result;
+    }
 
     print_how_to_play();
 
     double prev_time = glfwGetTime();
     while (glfwWindowShouldClose(window) == GL_FALSE) {
+        if (!g_game->needs_redraw()) {
+            // The last frame is still on screen; sleep until input arrives
+            g_idle_monitor.begin_idle();
+            glfwWaitEventsTimeout(IDLE_WAIT_TIMEOUT);
+            g_idle_monitor.end_idle();
+            prev_time = glfwGetTime() - 1.0 / FPS;
+            continue;
+        }
+
         const double current_time = glfwGetTime();
-        if (current_time - prev_time >= 1.0 / FPS) {
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            g_game.main_loop();
+        if (current_time - prev_time < 1.0 / FPS) {
+            glfwWaitEventsTimeout(prev_time + 1.0 / FPS - current_time);
+        } else {
+            if (g_use_dynamic_resolution) {
+                g_gpu_timer.begin_frame();
+            }
+            render_frame();
+            if (g_use_dynamic_resolution) {
+                // The GPU time is a few frames old, but reading it does not stall the pipeline
+                g_gpu_timer.end_frame();
+                const double cpu_time = glfwGetTime() - current_time;
+                g_dynamic_resolution.update(std::max(cpu_time, g_gpu_timer.get_seconds()));
+            }
             glfwSwapBuffers(window);
             glfwPollEvents();
+            g_gl_state.end_frame();
+            g_frame_stats.add_frame(current_time - prev_time, glfwGetTime() - current_time);
             prev_time = current_time;
         }
     }
+
+    printf("Idle for %.1f s with %.1f%% CPU usage\n", g_idle_monitor.get_idle_seconds(),
+           g_idle_monitor.get_cpu_usage());
+    shutdown_gl();
 }
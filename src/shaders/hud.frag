@@ -0,0 +1,12 @@
+#version 330
+
+in vec2 f_texcoord;
+in vec4 f_color;
+
+out vec4 out_color;
+
+uniform sampler2D u_texture;
+
+void main() {
+    out_color = f_color * texture(u_texture, f_texcoord);
+}
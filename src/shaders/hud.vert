@@ -0,0 +1,18 @@
+#version 330
+
+layout(location = 0) in vec2 in_position;
+layout(location = 1) in vec2 in_uv;
+layout(location = 2) in vec4 in_color;
+
+out vec2 f_texcoord;
+out vec4 f_color;
+
+uniform vec2 u_screen_size;
+
+void main() {
+    vec2 ndc    = in_position / u_screen_size * 2.0 - 1.0;
+    gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+
+    f_texcoord = in_uv;
+    f_color    = in_color;
+}
@@ -0,0 +1,60 @@
+#version 330
+
+#define BATCH_SIZE 128
+
+in vec3 f_position_camera_space;
+flat in int f_instance;
+
+out vec4 out_color;
+
+struct Sphere {
+    vec4 center_radius;
+    vec4 axis_x;
+    vec4 axis_y;
+    vec4 axis_z;
+};
+
+layout(std140) uniform PerDraw {
+    mat4 u_proj_mat;
+    vec4 u_light_pos;
+    vec4 u_specColor;
+    vec4 u_ambiColor;
+    float u_shininess;
+    Sphere u_spheres[BATCH_SIZE];
+};
+
+uniform samplerCube u_texture;
+
+void main() {
+    Sphere sphere = u_spheres[f_instance];
+    vec3 center   = sphere.center_radius.xyz;
+    float radius  = sphere.center_radius.w;
+
+    // Intersect the ray from the camera through this fragment with the sphere
+    vec3 ray  = normalize(f_position_camera_space);
+    float b   = dot(ray, center);
+    float det = b * b - dot(center, center) + radius * radius;
+    if (det < 0.0) {
+        discard;
+    }
+    vec3 position = ray * (b - sqrt(det));
+
+    vec4 clip    = u_proj_mat * vec4(position, 1.0);
+    gl_FragDepth = (clip.z / clip.w) * 0.5 + 0.5;
+
+    vec3 N             = (position - center) / radius;
+    vec3 pattern_dir   = mat3(sphere.axis_x.xyz, sphere.axis_y.xyz, sphere.axis_z.xyz) * N;
+    vec3 diffuse_color = texture(u_texture, pattern_dir).rgb;
+
+    vec3 V = normalize(-position);
+    vec3 L = normalize(u_light_pos.xyz - position);
+    vec3 H = normalize(V + L);
+
+    float ndotl   = max(0.0, dot(N, L));
+    float ndoth   = max(0.0, dot(N, H));
+    vec3 diffuse  = diffuse_color * ndotl;
+    vec3 specular = u_specColor.rgb * pow(ndoth, u_shininess);
+    vec3 ambient  = u_ambiColor.rgb;
+
+    out_color = vec4(diffuse + specular + ambient, 1.0);
+}
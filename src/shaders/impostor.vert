@@ -0,0 +1,43 @@
+#version 330
+
+#define BATCH_SIZE 128
+
+layout(location = 0) in vec2 in_corner;
+
+out vec3 f_position_camera_space;
+flat out int f_instance;
+
+struct Sphere {
+    vec4 center_radius;
+    vec4 axis_x;
+    vec4 axis_y;
+    vec4 axis_z;
+};
+
+layout(std140) uniform PerDraw {
+    mat4 u_proj_mat;
+    vec4 u_light_pos;
+    vec4 u_specColor;
+    vec4 u_ambiColor;
+    float u_shininess;
+    Sphere u_spheres[BATCH_SIZE];
+};
+
+void main() {
+    vec3 center  = u_spheres[gl_InstanceID].center_radius.xyz;
+    float radius = u_spheres[gl_InstanceID].center_radius.w;
+
+    // Quad through the center facing the camera, just large enough to cover the silhouette
+    float dist    = length(center);
+    vec3 view_dir = center / dist;
+    vec3 ref_up   = abs(view_dir.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 right    = normalize(cross(view_dir, ref_up));
+    vec3 up       = cross(right, view_dir);
+    float extent  = radius * dist / sqrt(max(dist * dist - radius * radius, 1e-6));
+
+    vec3 position = center + (in_corner.x * right + in_corner.y * up) * extent;
+    gl_Position   = u_proj_mat * vec4(position, 1.0);
+
+    f_position_camera_space = position;
+    f_instance              = gl_InstanceID;
+}
@@ -7,9 +7,16 @@ in vec3 f_diffuse;
 
 out vec4 out_color;
 
-uniform vec3 u_specColor;
-uniform vec3 u_ambiColor;
-uniform float u_shininess;
+layout(std140) uniform PerDraw {
+    mat4 u_mv_mat;
+    mat4 u_mvp_mat;
+    mat4 u_norm_mat;
+    mat4 u_light_mat;
+    vec4 u_light_pos;
+    vec4 u_specColor;
+    vec4 u_ambiColor;
+    float u_shininess;
+};
 
 void main() {
     vec3 V = normalize(-f_position_camera_space);
@@ -20,8 +27,8 @@ void main() {
     float ndotl   = max(0.0, dot(N, L));
     float ndoth   = max(0.0, dot(N, H));
     vec3 diffuse  = f_diffuse * ndotl;
-    vec3 specular = u_specColor * pow(ndoth, u_shininess);
-    vec3 ambient  = u_ambiColor;
+    vec3 specular = u_specColor.rgb * pow(ndoth, u_shininess);
+    vec3 ambient  = u_ambiColor.rgb;
 
     out_color = vec4(diffuse + specular + ambient, 1.0);
 }
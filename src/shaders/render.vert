@@ -9,18 +9,23 @@ out vec3 f_normal_camera_space;
 out vec3 f_light_pos_camera_space;
 out vec3 f_diffuse;
 
-uniform vec3 u_light_pos;
-uniform mat4 u_mv_mat;
-uniform mat4 u_mvp_mat;
-uniform mat4 u_norm_mat;
-uniform mat4 u_light_mat;
+layout(std140) uniform PerDraw {
+    mat4 u_mv_mat;
+    mat4 u_mvp_mat;
+    mat4 u_norm_mat;
+    mat4 u_light_mat;
+    vec4 u_light_pos;
+    vec4 u_specColor;
+    vec4 u_ambiColor;
+    float u_shininess;
+};
 
 void main() {
     gl_Position = u_mvp_mat * vec4(in_position, 1.0);
 
     f_position_camera_space  = (u_mv_mat * vec4(in_position, 1.0)).xyz;
     f_normal_camera_space    = (u_norm_mat * vec4(in_normal, 0.0)).xyz;
-    f_light_pos_camera_space = (u_light_mat * vec4(u_light_pos, 1.0)).xyz;
+    f_light_pos_camera_space = (u_light_mat * vec4(u_light_pos.xyz, 1.0)).xyz;
 
     f_diffuse = in_diffuse;
 }